@@ -12,6 +12,29 @@
 #include <iostream>
 #include <iterator>
 #include <initializer_list>
+#include <unordered_map>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <limits>
+#include "BST_storage.h"
+#ifdef BST_LATENCY_HISTOGRAMS
+#include "BST_latency.h"
+#endif
+
+
+//!Hint the CPU to fetch the node pointed by ptr into the cache, when the compiler supports it
+#if defined(__GNUC__) || defined(__clang__)
+#define BST_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define BST_PREFETCH(ptr) ((void)(ptr))
+#endif
 
 
 #ifdef __BST_DEV__
@@ -30,27 +53,262 @@ namespace BST_testing {
 #endif
 
 
+/**
+ * Namespace containing the execution policies accepted by the bulk operations
+ * of BST (for_each, transform_reduce).
+ */
+namespace BST_execution {
+
+    /**
+     * Policy requesting a bulk operation to be run by the calling thread, visiting
+     * the pairs in-order.
+     */
+    struct sequenced_policy {};
+    /**
+     * Policy requesting a bulk operation to be split among several threads. The
+     * order in which pairs are visited is unspecified. Threads are created for each
+     * operation, which costs tens of microseconds, so trees with fewer pairs than
+     * cutoff are processed by the calling thread alone.
+     */
+    struct parallel_policy {
+	//! Number of threads to use, 0 stands for std::thread::hardware_concurrency()
+	unsigned threads{0};
+	//! Smallest number of pairs in the tree for the work to be split among threads
+	size_t cutoff{size_t{1} << 15};
+    };
+
+    //! Sequenced policy instance, in the spirit of std::execution::seq
+    constexpr sequenced_policy seq{};
+    //! Parallel policy instance using all hardware threads, in the spirit of std::execution::par
+    constexpr parallel_policy par{};
+}
+
+
+/**
+ * Namespace containing the settings of the automatic rebalancing of BSTs, see
+ * BST::set_rebalance_policy.
+ */
+namespace BST_rebalance {
+
+    //! What insert does when the tree has grown too tall
+    enum class mode {
+	//! nothing, the tree is only rebalanced by explicit calls to balance
+	off,
+	//! call balance right away, before insert returns
+	synchronous,
+	//! record that a rebalance is due, which is then done by the next call to maintain
+	deferred
+    };
+
+    /**
+     * Policy of automatic rebalancing. A tree is too tall when its height exceeds
+     * factor * log2(size + 1) while it holds at least min_size pairs.
+     */
+    struct policy {
+	mode action{mode::off};
+	double factor{2.0};
+	size_t min_size{64};
+    };
+
+    //! Counters of the automatic rebalancing of a tree
+    struct stats {
+	//! number of times the tree was found too tall
+	size_t triggers;
+	//! number of rebalances done by insert or maintain
+	size_t rebalances;
+	//! height of the tree, as tracked by insert
+	size_t height;
+	//! whether a deferred rebalance is waiting for maintain
+	bool pending;
+    };
+}
+
+
+/**
+ * Trait telling whether the nodes of BSTs having keys of type K store, next to the key, an
+ * 8 bytes prefix of it. get must return the first 8 bytes of the key in big-endian order,
+ * padded with zeros, so that comparing prefixes as integers agrees with std::less<K>.
+ * Comparing the prefix first saves dereferencing the heap buffer of the key on most levels.
+ * Specialize it to enable the prefix for other string-like keys.
+ */
+template <class K>
+struct BST_key_prefix {
+    static constexpr bool enabled{false};
+};
+
+#ifndef BST_NO_KEY_PREFIX
+/**
+ * Key prefixes are enabled for std::string, unless BST_NO_KEY_PREFIX is defined (consistently
+ * in every translation unit).
+ */
+template <>
+struct BST_key_prefix<std::string> {
+    static constexpr bool enabled{true};
+    static std::uint64_t get(const std::string& key) noexcept {
+	std::uint64_t prefix{0};
+	const size_t length{std::min(key.size(), size_t{8})};
+	for (size_t i{0}; i < 8; ++i) //big-endian, characters compare as unsigned char in std::string
+	    prefix = (prefix << 8) | (i < length ? static_cast<unsigned char>(key[i]) : 0u);
+	return prefix;
+    }
+};
+#endif
+
+
 namespace {
 
+    /**
+     * BST_node_prefix struct, base of BST_node storing the key prefix when enabled for K, and
+     * empty otherwise.
+     */
+    template <class K, bool = BST_key_prefix<K>::enabled>
+    struct BST_node_prefix {
+	BST_node_prefix(const K&) noexcept {}
+    };
+
+    template <class K>
+    struct BST_node_prefix<K, true> {
+	//! first 8 bytes of the key, big-endian
+	std::uint64_t key_prefix;
+	BST_node_prefix(const K& key) noexcept : key_prefix{BST_key_prefix<K>::get(key)} {}
+    };
+
+    /**
+     * BST_prefixed trait, whether the nodes of a BST<K, V, Comp> store key prefixes: only if
+     * they are enabled for K and Comp is std::less, the one ordering prefixes agree with.
+     */
+    template <class K, class Comp>
+    struct BST_prefixed : std::integral_constant<bool, BST_key_prefix<K>::enabled &&
+	(std::is_same<Comp, std::less<K>>::value || std::is_same<Comp, std::less<>>::value)> {};
+
+#ifdef BST_PROBE_COUNTERS
+    /**
+     * BST_probe struct, counts the nodes visited and the calls to the comparison made by a
+     * single find or insert. Without BST_PROBE_COUNTERS it is empty and counts nothing, so that
+     * the counting vanishes from the compiled code.
+     */
+    struct BST_probe {
+	size_t nodes{0}, comparisons{0};
+	void node() noexcept {++nodes;}
+	void comparison() noexcept {++comparisons;}
+    };
+
+    /**
+     * BST_probe_counters struct, totals of the probes of the finds and inserts on a BST. The
+     * counters are atomic since finds on a const BST may run concurrently.
+     */
+    struct BST_probe_counters {
+	std::atomic<size_t> finds{0}, find_nodes{0}, find_comparisons{0};
+	std::atomic<size_t> inserts{0}, insert_nodes{0}, insert_comparisons{0};
+    };
+#else
+    struct BST_probe {
+	void node() noexcept {}
+	void comparison() noexcept {}
+    };
+#endif
+
+    /**
+     * BST_LATENCY_TIMER declares a timer recording the latency of the enclosing operation of a
+     * BST into the histograms of BST_latency. Without BST_LATENCY_HISTOGRAMS it expands to
+     * nothing, and no clock is read.
+     */
+#ifdef BST_LATENCY_HISTOGRAMS
+#define BST_LATENCY_TIMER(op) const BST_latency::timer latency_timer{BST_latency::operation::op}
+#else
+#define BST_LATENCY_TIMER(op)
+#endif
+
     /**
      * BST_Node struct, represents a node in a BST.
      */
-    template <class K, class V>
+    template <class K, class V, bool Prefixed = BST_key_prefix<K>::enabled>
     struct BST_node;
     /**
      * BST_iterator class, made compliant with the STL. Allows in-order traversal of BSTs.
      */
-    template <class K, class V>
+    template <class K, class V, bool Prefixed = BST_key_prefix<K>::enabled>
     class BST_iterator;
     /**
      *BST_const_iterator class. Allows iteration through const BSTs.
      */
-    template <class K, class V>
+    template <class K, class V, bool Prefixed = BST_key_prefix<K>::enabled>
     class BST_const_iterator;
+    /**
+     * BST_range class, a splittable range of consecutive key-value pairs of a BST, in the
+     * spirit of TBB blocked_range.
+     */
+    template <class K, class V, class Comp>
+    class BST_range;
+    /**
+     * BST_cursor class, hands out the key-value pairs of a BST in-order, in batches.
+     */
+    template <class K, class V, bool Prefixed = BST_key_prefix<K>::enabled>
+    class BST_cursor;
+    /**
+     * BST_index class, interface of the optional hash index mapping keys to nodes.
+     */
+    template <class K, class V, bool Prefixed = BST_key_prefix<K>::enabled>
+    class BST_index;
+    /**
+     * BST_hash_index class, hash index built on std::unordered_map.
+     */
+    template <class K, class V, class Comp, class Hash>
+    class BST_hash_index;
+    /**
+     * BST_filter class, interface of the optional approximate membership filter on keys.
+     */
+    template <class K>
+    class BST_filter;
+    /**
+     * BST_bloom_filter class, blocked Bloom filter whose probes for a key fall in one cache line.
+     */
+    template <class K, class Hash>
+    class BST_bloom_filter;
+    /**
+     * BST_dense class, direct-addressed array of the nodes of a BST whose integral keys are dense.
+     */
+    template <class K, class V>
+    class BST_dense;
+
+    /**
+     * BST_inline_nodes struct, room for the nodes of a BST holding at most N pairs inside the
+     * BST object itself. Nodes are constructed in the slots in insertion order, and the slots
+     * sorted by key are kept in order, together with the key prefixes when the BST uses them,
+     * so that a key is looked up in small sorted arrays. Empty when N is 0.
+     */
+    template <class K, class V, std::size_t N, bool Prefixed>
+    struct BST_inline_nodes {
+	static_assert(N < 256, "slots are numbered by a byte");
+	//!Whether the nodes of the BST are the ones in the slots
+	bool active{true};
+	//!Slots of the nodes, sorted by key
+	std::uint8_t order[N];
+	//!Key prefixes of the nodes, sorted, if the BST uses them
+	std::uint64_t prefixes[Prefixed ? N : 1];
+	//!Storage of the nodes
+	alignas(BST_node<K,V,Prefixed>) unsigned char slots[N][sizeof(BST_node<K,V,Prefixed>)];
+
+	//!Return the node constructed in the given slot
+	BST_node<K,V,Prefixed>& node(const std::size_t slot) noexcept {
+	    return *std::launder(reinterpret_cast<BST_node<K,V,Prefixed>*>(slots[slot]));
+	}
+	const BST_node<K,V,Prefixed>& node(const std::size_t slot) const noexcept {
+	    return *std::launder(reinterpret_cast<const BST_node<K,V,Prefixed>*>(slots[slot]));
+	}
+    };
+
+    template <class K, class V, bool Prefixed>
+    struct BST_inline_nodes<K, V, 0, Prefixed> {
+    };
 }
 
-template <class K, class V, class Comp = std::less<K>>
-class BST{
+/**
+ * The inline nodes are a private base of BST rather than a member, so that they take no room
+ * at all when N is 0 (empty base optimization).
+ */
+template <class K, class V, class Comp = std::less<K>, std::size_t N = 0>
+class BST : private BST_inline_nodes<K,V,N,BST_prefixed<K,Comp>::value> {
 
     public:
 	//!Alias for the type of keys in the tree
@@ -66,21 +324,113 @@ class BST{
 
     private:
 
+	//!Whether nodes store key prefixes that agree with Comp, that is if Comp is std::less
+	static constexpr bool prefixed{BST_prefixed<K,Comp>::value};
 	//!Alias for the node type
-	using node_type = BST_node<K,V>;//This alias is left private since nodes are not intendend for user usage.
+	using node_type = BST_node<K,V,prefixed>;//This alias is left private since nodes are not intendend for user usage.
 
 	//!Pointer to the root node of the BST
 	std::unique_ptr<node_type> root;
 	//!Function object defining the comparison criteria for key_type objects.
 	Comp compare;
+	//!Number of nodes in the BST
+	size_t node_count{0};
+	//!Optional hash index mapping keys to nodes, nullptr when disabled
+	std::unique_ptr<BST_index<K,V,prefixed>> index;
+	//!Optional filter on the keys in the BST, nullptr when disabled
+	std::unique_ptr<BST_filter<K>> filter;
+	//!Whether keys can be addressed directly, that is if they are integers and Comp is std::less
+	static constexpr bool densable{std::is_integral<K>::value && !std::is_same<K, bool>::value && sizeof(K) <= sizeof(size_t) &&
+	    (std::is_same<Comp, std::less<K>>::value || std::is_same<Comp, std::less<>>::value)};
+	//!Optional direct-addressed array of the nodes, used while keys are dense, nullptr when disabled
+	std::unique_ptr<BST_dense<K,V>> dense;
+	//!Settings of the automatic rebalancing
+	BST_rebalance::policy rebalancing{};
+	//!Height of the tree: deepest level reached by an insertion since the last clear
+	size_t max_depth{0};
+	//!Number of times the tree was found too tall, and of automatic rebalances
+	size_t rebalance_triggers{0}, rebalance_count{0};
+	//!Whether a deferred rebalance is due, and whether balance is running
+	bool rebalance_pending{false}, balancing{false};
+#ifdef BST_PROBE_COUNTERS
+	//!Work done by finds and inserts, not copied nor moved along with the pairs
+	mutable BST_probe_counters probes;
+#endif
+	//!Alias for the nodes stored inside the BST while it holds at most N pairs, its private base
+	using inline_type = BST_inline_nodes<K,V,N,prefixed>;
+	//!Return the nodes stored inside the BST
+	inline_type& inline_nodes() noexcept {return *this;}
+	const inline_type& inline_nodes() const noexcept {return *this;}
+	//!Whether moving the inline nodes to another BST cannot throw
+	static constexpr bool nothrow_relocation{N == 0 ||
+	    (std::is_nothrow_copy_constructible<K>::value && std::is_nothrow_move_constructible<V>::value)};
+
+	/**
+	 * Utility function looking up a key among the inline nodes, by a linear scan of the sorted
+	 * prefixes when the BST uses them, and a binary search of the sorted slots whose keys share
+	 * the prefix of key.
+	 * @param key the sought-after key
+	 * @param prefix the prefix of key, as returned by prefix_of
+	 * @param position set to the position of key in the sorted slots, or to the position it
+	 * would be inserted at
+	 * @param probe counts the nodes visited and the calls to the comparison
+	 * @return the node having the key, nullptr if there is none
+	 */
+	node_type* find_inline(const key_type& key, const std::uint64_t prefix, size_t& position, BST_probe& probe) const;
+	/**
+	 * Utility function adding a node to the inline nodes, at the given position in the
+	 * sorted slots. The node is linked below the node before or after it in key order, in
+	 * constant time.
+	 */
+	void insert_inline(const size_t position, const key_type& key, const value_type& value);
+	/**
+	 * Utility function linking the inline nodes again into a perfectly balanced tree.
+	 */
+	void link_inline() noexcept;
+	/**
+	 * Utility function linking the inline nodes in the sorted slots [lo, hi) below parent.
+	 * @return the root of the subtree
+	 */
+	node_type* link_inline(const size_t lo, const size_t hi, node_type* parent) noexcept;
+	/**
+	 * Utility function constructing in the slots of this (empty) BST the inline nodes of
+	 * other, in the same slots and linked in the same way. The values are moved if other is
+	 * an rvalue.
+	 * @param other BST whose nodes are inline
+	 */
+	template <class Tree>
+	void copy_inline(Tree&& other);
+	/**
+	 * Utility function moving the inline nodes of other into this (empty) BST, other is
+	 * left with no nodes.
+	 */
+	void take_inline(BST& other) noexcept(nothrow_relocation);
+	/**
+	 * Utility function selecting whether the nodes are to be stored inline, a no-op if N is 0.
+	 */
+	void set_inline(const bool active) noexcept;
+	/**
+	 * Return the slot of an inline node.
+	 */
+	size_t slot_of(const node_type& node) const noexcept;
+	/**
+	 * Utility function destroying the inline nodes, the links between them are dropped
+	 * without freeing anything.
+	 */
+	void free_inline() noexcept;
+	/**
+	 * Utility function moving the pairs from the inline nodes to heap nodes, once the BST
+	 * is about to hold more than N pairs. The tree keeps its shape.
+	 */
+	void grow();
 
 	/**
-	 * Utility function to insert in the BST a full subtree. Elements of the subtree are
-	 * inserted in the BST starting at the root and then recursively inserting the
-	 * left and right subtrees.
-	 * @param subtree to copy into the BST
+	 * Utility function to copy a full tree into this (empty) BST, preserving its structure.
+	 * Nodes are visited in pre-order by following parent pointers, so no recursion is
+	 * involved and the copy is linear in the number of nodes even for degenerate trees.
+	 * @param other_root root node of the tree to copy into the BST
 	 */
-	void insert( const node_type& subtree);
+	void copy(const node_type& other_root);
 	/**
 	 * Utility function to insert in the tree the median element, with respect to
 	 * given boundaries, from a vector of pair_type.
@@ -89,10 +439,125 @@ class BST{
 	 * @param hi max index to consider in the given vector
 	 */
 	void insert_median(std::vector<pair_type>& vect , const size_t lo, const size_t hi);
+	/**
+	 * Utility function freeing the nodes of a subtree iteratively, by repeatedly rotating the
+	 * left subtree above the top node and then freeing a top node with no left child.
+	 * @param top owner of the subtree, empty afterwards
+	 */
+	static void free_nodes(std::unique_ptr<node_type>& top) noexcept;
+	/**
+	 * Utility function appending to order the nodes lying less than levels levels below node,
+	 * in van Emde Boas order: the top half of the levels is laid out recursively, followed by
+	 * each subtree hanging below it, left to right, laid out recursively as well.
+	 * @param node root of the subtree
+	 * @param levels number of levels to lay out, at least the height of the subtree to get all of it
+	 * @param order vector receiving the nodes
+	 */
+	static void layout_veb(node_type* node, const size_t levels, std::vector<node_type*>& order);
         /**
          * Return a pointer to the node having the smallest key.
          */
         node_type* get_min() const noexcept;
+	/**
+	 * Return the prefix of the given key stored in nodes, 0 if prefixes are not used.
+	 */
+	static std::uint64_t prefix_of(const key_type& key) noexcept;
+	/**
+	 * Utility function comparing a key with the key of a node, by their prefixes first when
+	 * they are used, and by the full keys only if prefixes are equal.
+	 * @param key the key to compare
+	 * @param prefix the prefix of key, as returned by prefix_of
+	 * @param node the node to compare key with
+	 * @param probe counts the calls to the comparison
+	 * @return a negative value if key comes before the key of node, a positive one if it comes
+	 * after it, 0 if they are equivalent
+	 */
+	int order(const key_type& key, const std::uint64_t prefix, const node_type& node, BST_probe& probe) const;
+	/**
+	 * Utility functions adding the probe of a find or of an insert to the counters, no-ops
+	 * unless BST_PROBE_COUNTERS is defined.
+	 */
+	void count_find(const BST_probe& probe) const noexcept;
+	void count_insert(const BST_probe& probe) noexcept;
+	/**
+	 * Utility function called when an insertion reaches a new depth: if the tree is too tall
+	 * according to the rebalance policy, rebalance it or mark a rebalance as due.
+	 */
+	void check_height();
+	/**
+	 * Utility function splitting the BST into disjoint subtrees for parallel processing.
+	 * The cutoff depth is chosen so that there are about eight subtrees per thread, which
+	 * are then picked dynamically by the threads to balance the load.
+	 * @param threads number of threads that will process the subtrees
+	 * @param top vector filled with the nodes lying above the cutoff depth
+	 * @return the roots of the subtrees hanging at the cutoff depth
+	 */
+	std::vector<node_type*> split(const unsigned threads, std::vector<node_type*>& top) const;
+	/**
+	 * Utility function calling f on every node of a subtree, in pre-order. An explicit stack
+	 * is used in place of recursion.
+	 * @param subtree root of the subtree to visit
+	 * @param f function object called on each node
+	 */
+	template <class F>
+	static void visit_subtree(node_type& subtree, F& f);
+	/**
+	 * Utility function handing the given tasks (subtree roots or ranges) to a pool of threads.
+	 * Each thread repeatedly picks the next unprocessed task and calls f on it together with
+	 * its index. Exceptions thrown by f are rethrown in the calling thread once all the threads
+	 * have joined.
+	 * @param threads number of threads to use, including the calling one
+	 * @param tasks tasks to process
+	 * @param f function object called on each task and its index in tasks
+	 */
+	template <class T, class F>
+	static void run_parallel(const unsigned threads, std::vector<T>& tasks, F f);
+	/**
+	 * Return a pointer to the node having the smallest key not less than the given one,
+	 * nullptr if there is none.
+	 * @param key the lower bound
+	 */
+	node_type* lower_bound(const key_type& key) const noexcept;
+	/**
+	 * Utility function calling f on the nodes having keys in [*lo, *hi), in-order. A null bound
+	 * stands for no bound. The traversal uses an explicit stack of the nodes still to visit and
+	 * prefetches the right child of every node pushed on it, which is the next subtree to be
+	 * visited once the left one has been done.
+	 * @param subtree root of the subtree to visit
+	 * @param lo pointer to the smallest key to visit, or nullptr
+	 * @param hi pointer to the first key not to visit, or nullptr
+	 * @param f function object called on each node
+	 */
+	template <class F>
+	void visit(node_type* subtree, const key_type* lo, const key_type* hi, F&& f) const;
+	/**
+	 * Utility function calling f on the nodes having keys in [*lo, *hi), in-order, like visit
+	 * on the whole tree, but by a scan of the direct-addressed array while it is in use.
+	 */
+	template <class F>
+	void visit_ordered(const key_type* lo, const key_type* hi, F&& f) const;
+	/**
+	 * Utility function rebuilding the direct-addressed array from the nodes if it is enabled
+	 * and the keys are dense enough, and leaving it unused otherwise.
+	 */
+	void densify() noexcept;
+	/**
+	 * Utility function adding a new node to the direct-addressed array while it is in use.
+	 */
+	void add_dense(node_type* node) noexcept;
+	/**
+	 * Utility function splitting the BST like split, but returning the nodes above the cutoff
+	 * depth and the roots of the subtrees at the cutoff together, in-order. The second member
+	 * of each pair tells whether the node stands for its whole subtree.
+	 * @param threads number of threads that will process the subtrees
+	 */
+	std::vector<std::pair<node_type*, bool>> split_inorder(const unsigned threads) const;
+	/**
+	 * Utility function returning the depth at which the BST is split to be processed by the
+	 * given number of threads, so that there are about eight subtrees per thread.
+	 * @param threads number of threads
+	 */
+	static size_t cutoff_depth(const unsigned threads) noexcept;
 
     public:
 
@@ -114,52 +579,114 @@ class BST{
 	 * constructor also preserves the structure of the copied BST.
 	 * @param other BST to be copied
 	 */
-	BST (const BST<K,V,Comp> &other) : root{}, compare{}
+	BST (const BST<K,V,Comp,N> &other) : root{}, compare{other.compare}, node_count{other.node_count}, index{},
+	  filter{other.filter ? other.filter->clone() : nullptr}, rebalancing{other.rebalancing}, max_depth{other.max_depth},
+	  rebalance_pending{other.rebalance_pending}
 	{
-	    insert(*other.root);//recursively inserts all nodes in other starting at the root node
+	    if (other.is_inline())
+		copy_inline(other);
+	    else if (other.root) {
+		set_inline(false);
+		copy(*other.root);//iteratively copies all nodes in other starting at the root node
+	    }
+	    if (other.index) {    //the copy gets its own index, pointing to its own nodes
+		index = other.index->clone_empty();
+		if (!is_inline())
+		    visit(root.get(), nullptr, nullptr, [this](node_type& n) { index->insert(&n); });
+	    }
+	    if constexpr (densable) {    //likewise for the direct-addressed array
+		if (other.dense) {
+		    dense.reset(new BST_dense<K,V>{other.dense->density()});
+		    densify();
+		}
+	    }
 	}
         /**
          * Copy assignment, copy all the members from one tree to this
          * @param other BST to copy
          */
-        BST& operator=(const BST<K,V,Comp> &other) {
+        BST& operator=(const BST<K,V,Comp,N> &other) {
+            if (this == &other)    //clear() would empty other as well
+                return *this;
             clear();    //free any memory
             auto temp{other};    //call copy constructor
             (*this) = std::move(temp);    //call move assignment
             return *this;
         }
 	/**
-	 * Move constructor, create a new BST by swapping members.
+	 * Move constructor, create a new BST by swapping members. Inline nodes cannot be handed
+	 * over, so they are built again in this BST, copying the keys and moving the values: the
+	 * constructor is noexcept as long as that cannot throw.
 	 * @param other BST to move
 	 */
-	BST (BST<K,V,Comp> &&other) noexcept : root{}, compare{} {
+	BST (BST<K,V,Comp,N> &&other) noexcept(nothrow_relocation) : root{}, compare{}, node_count{other.node_count}, index{std::move(other.index)},
+	  filter{std::move(other.filter)}, dense{std::move(other.dense)}, rebalancing{other.rebalancing}, max_depth{other.max_depth},
+	  rebalance_triggers{other.rebalance_triggers}, rebalance_count{other.rebalance_count}, rebalance_pending{other.rebalance_pending} {
 
-	    root.swap(other.root);
+	    if (other.is_inline())
+		take_inline(other);
+	    else {
+		set_inline(false);
+		root.swap(other.root);
+		other.set_inline(true);
+	    }
+	    other.node_count = 0;
+	    other.max_depth = 0;
+	    other.rebalance_pending = false;
 	}
         /**
          * Move assignment, move the members of other onto this.
          * @param other BST to move
          */
-        BST& operator=(BST<K,V,Comp> &&other) noexcept {
-            root = std::move(other.root);
+        BST& operator=(BST<K,V,Comp,N> &&other) noexcept(nothrow_relocation) {
+            if (this == &other)    //clear() would empty other as well
+                return *this;
+            clear();    //tear down the old nodes iteratively
             compare = std::move(other.compare);
+            node_count = other.node_count;
+            index = std::move(other.index);
+            filter = std::move(other.filter);
+            dense = std::move(other.dense);
+            if (other.is_inline())
+                take_inline(other);
+            else {
+                set_inline(false);
+                root = std::move(other.root);
+                other.set_inline(true);
+            }
+            other.node_count = 0;
+            rebalancing = other.rebalancing;
+            max_depth = other.max_depth;
+            rebalance_triggers = other.rebalance_triggers;
+            rebalance_count = other.rebalance_count;
+            rebalance_pending = other.rebalance_pending;
+            other.max_depth = 0;
+            other.rebalance_pending = false;
             return *this;
         }
 	/**
-	 * Default destructor
+	 * Destructor, frees the nodes through clear() so that the unique_ptr chain is never
+	 * destroyed recursively.
 	 */
-	~BST() noexcept = default;
+	~BST() noexcept {
+
+	    clear();
+	}
 
 	//!Alias for iterators
-	using iterator = BST_iterator<K,V>;
+	using iterator = BST_iterator<K,V,prefixed>;
 	//!Alias for const iterators
-	using const_iterator = BST_const_iterator<K,V>;
+	using const_iterator = BST_const_iterator<K,V,prefixed>;
+	//!Alias for splittable ranges
+	using range_type = BST_range<K,V,Comp>;
+	//!Alias for batch cursors
+	using cursor_type = BST_cursor<K,V,prefixed>;
         /**
          * Returns an iterator to the node having a key equal to the input key, end()
          * if it is not found. Moves down the tree exploiting the ordering of the keys.
          * @param key the sought-after key
          */
-        iterator find(const key_type key) const noexcept;
+        iterator find(const key_type& key) const noexcept;
         /**
          * non-const begin and end functions. Allow the BST to support range for-loops.
          * begin returns an iterator to the node having the smallest key
@@ -186,6 +713,26 @@ class BST{
          * cend returns a const_iterator to nullptr
          */
         const_iterator cend() const noexcept {return const_iterator{nullptr};}
+	/**
+	 * Return a splittable range spanning the whole BST.
+	 * @param grainsize the range is not split further once it holds at most grainsize pairs
+	 */
+	range_type range(const size_t grainsize = 1) const noexcept {
+
+	    return range_type{root.get(), &compare, get_min(), nullptr, grainsize};
+	}
+	/**
+	 * Return a splittable range spanning the keys in [lo, hi).
+	 * @param lo smallest key in the range
+	 * @param hi first key past the range
+	 * @param grainsize the range is not split further once it holds at most grainsize pairs
+	 */
+	range_type range(const key_type& lo, const key_type& hi, const size_t grainsize = 1) const noexcept {
+
+	    node_type* first{lower_bound(lo)};
+	    node_type* last{compare(lo, hi) ? lower_bound(hi) : first}; //an inverted interval gives an empty range
+	    return range_type{root.get(), &compare, first, last, grainsize};
+	}
 	/**
 	 * Insert a key-value pair in the BST composed by the given key and value.
 	 * @param key the key in the pair
@@ -201,88 +748,455 @@ class BST{
 	    insert(pair.first, pair.second);
 	}
 	/**
-	 * Balance the current BST.
+	 * Write the keys and the values of the BST, in-order, into two separate contiguous arrays.
+	 * Both vectors are resized to size(); the traversal is the one of visit_inorder.
+	 * @param keys vector receiving the keys
+	 * @param values vector receiving the values, values[i] being associated to keys[i]
 	 */
-	void balance();
+	void export_columns(std::vector<key_type>& keys, std::vector<value_type>& values) const;
+	/**
+	 * Write the keys and the values of the BST into two separate contiguous arrays, in parallel.
+	 * The tree is split into subtrees as in for_each; their sizes are counted in parallel to
+	 * compute the offset of each of them, and then each subtree is written in-order at its
+	 * offset by a single thread.
+	 * @param policy parallel policy giving the number of threads to use
+	 * @param keys vector receiving the keys
+	 * @param values vector receiving the values, values[i] being associated to keys[i]
+	 */
+	void export_columns(const BST_execution::parallel_policy policy, std::vector<key_type>& keys, std::vector<value_type>& values) const;
+	/**
+	 * Write the keys in [lo, hi) and their values, in-order, into two separate contiguous arrays.
+	 * Both vectors are overwritten.
+	 * @param lo smallest key to export
+	 * @param hi first key not to export
+	 * @param keys vector receiving the keys
+	 * @param values vector receiving the values, values[i] being associated to keys[i]
+	 */
+	void export_columns(const key_type& lo, const key_type& hi, std::vector<key_type>& keys, std::vector<value_type>& values) const;
+	/**
+	 * Return a cursor handing out the key-value pairs of the BST in-order, in batches.
+	 */
+	cursor_type cursor() const;
+	/**
+	 * Return a cursor handing out in-order, in batches, the key-value pairs having keys not less
+	 * than from. Allows to resume an export from a key saved through cursor_type::position.
+	 * @param from smallest key to hand out
+	 */
+	cursor_type cursor(const key_type& from) const;
 	/**
-	 * Remove all key-value pairs from the BST.
+	 * Call f on every key-value pair of the BST, in-order. Faster than a range for-loop, since
+	 * no parent pointer has to be climbed and the next nodes are prefetched.
+	 * @param f function object taking a pair_type&
 	 */
-	void clear() noexcept {
+	template <class F>
+	void visit_inorder(F f) {
 
-	    root.reset(nullptr);
+	    visit_ordered(nullptr, nullptr, [&f](node_type& n) { f(n.data); });
 	}
 	/**
-         * Overload of the operator[], in const and non-const version
-         */
-	value_type& operator[] (const key_type&);
-	const value_type& operator[] (const key_type&) const;
-
-};
+	 * Call f on every key-value pair of a const BST, in-order.
+	 * @param f function object taking a const pair_type&
+	 */
+	template <class F>
+	void visit_inorder(F f) const {
 
-/*
- * Node struct
- */
-namespace{
-    template<class K, class V>
-    struct BST_node {
+	    visit_ordered(nullptr, nullptr, [&f](const node_type& n) { f(n.data); });
+	}
+	/**
+	 * Call f on every key-value pair having key in [lo, hi), in-order.
+	 * @param lo smallest key to visit
+	 * @param hi first key not to visit
+	 * @param f function object taking a pair_type&
+	 */
+	template <class F>
+	void visit_range(const key_type& lo, const key_type& hi, F f) {
 
-	    using pair_type=typename BST<K,V>::pair_type;
-	    using key_type=typename BST<K,V>::key_type;
-	    using value_type=typename BST<K,V>::value_type;
-	    using node_type=BST_node<K,V>;
+	    visit_ordered(&lo, &hi, [&f](node_type& n) { f(n.data); });
+	}
+	/**
+	 * Call f on every key-value pair of a const BST having key in [lo, hi), in-order.
+	 * @param lo smallest key to visit
+	 * @param hi first key not to visit
+	 * @param f function object taking a const pair_type&
+	 */
+	template <class F>
+	void visit_range(const key_type& lo, const key_type& hi, F f) const {
 
-	    //! Pointers to left and right child of the node
-	    std::unique_ptr<node_type> left_child, right_child;
-	    //! Pointer to the parent of this node
-	    node_type* parent;
-	    //! Key-value pair stored in the node
-	    pair_type data;
+	    visit_ordered(&lo, &hi, [&f](const node_type& n) { f(n.data); });
+	}
+	/**
+	 * Call f on every key-value pair of the BST, in-order and from the calling thread.
+	 * @param f function object taking a pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::sequenced_policy, F f) {
 
-	    /**
-	     * Default constructor for BST_node
-	     */
-	    BST_node() = delete;    //delete default constructor
-	    /**
-	     * Create a new node having the given data stored in it and the given parent
-	     * @param key key of the key-value pair to store in the node
-	     * @param value value of the key-value pair to store in the node
-	     * @param father pointer to the parent of the node
-	     */
-	    BST_node(const key_type key, const value_type value, node_type* father)
-	     : left_child{nullptr}, right_child{nullptr}, parent{father}, data{key, value}
-	    {}
-	    /**
-	     * Default destructor for nodes
-	     */
-	    ~BST_node() noexcept = default;
-    };
-}
+	    for (auto& x : *this)
+		f(x);
+	}
+	/**
+	 * Call f on every key-value pair of a const BST, in-order and from the calling thread.
+	 * @param f function object taking a const pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::sequenced_policy, F f) const {
 
-/*
- * Iterator class, made compliant with the STL. In particular, the iterator allows to traverse the tree
- * in-order, that is from the smallest to the greatest key.
- */
-namespace {
-template<class K, class V>
-class BST_iterator : public std::iterator<std::forward_iterator_tag, std::pair<const K,V>>{
+	    for (const auto& x : *this)
+		f(x);
+	}
+	/**
+	 * Call f on every key-value pair of the BST, splitting the tree into disjoint subtrees
+	 * processed by a pool of threads. f must be safe to call concurrently on different pairs.
+	 * @param policy parallel policy giving the number of threads to use
+	 * @param f function object taking a pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::parallel_policy policy, F f);
+	/**
+	 * Call f on every key-value pair of a const BST, in parallel.
+	 * @param policy parallel policy giving the number of threads to use
+	 * @param f function object taking a const pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::parallel_policy policy, F f) const;
+	/**
+	 * Call f on every key-value pair of the given range, in-order and from the calling thread.
+	 * @param r range to visit, obtained through range()
+	 * @param f function object taking a pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::sequenced_policy, range_type r, F f) const {
 
-        using pair_type = typename BST<K,V>::pair_type;
-        using node_type=BST_node<K,V>;
-        //! a pointer to the node the iterator is currently over
-        node_type* current;
+	    for (auto it = r.begin(); it != r.end(); ++it)
+		f(*it);
+	}
+	/**
+	 * Call f on every key-value pair of the given range. The range is split in halves, breadth
+	 * first, until there are about eight pieces per thread or no piece is divisible any more,
+	 * and the pieces are then handed to a pool of threads.
+	 * @param policy parallel policy giving the number of threads to use
+	 * @param r range to visit, obtained through range()
+	 * @param f function object taking a pair_type&
+	 */
+	template <class F>
+	void for_each(const BST_execution::parallel_policy policy, range_type r, F f) const;
+	/**
+	 * Apply transform to every key-value pair and combine the results with reduce, starting
+	 * from init, in-order and from the calling thread.
+	 * @param init initial value of the reduction
+	 * @param reduce binary function object combining two T
+	 * @param transform function object mapping a const pair_type& to T
+	 */
+	template <class T, class R, class F>
+	T transform_reduce(const BST_execution::sequenced_policy, T init, R reduce, F transform) const {
 
-    public:
-        /**
-         * Constructor
-         * @param n the node to initialize current to
-         */
-        BST_iterator(node_type* n) : current{n} {}
-        /**
-         * dereferencing operator, returns an std::pair<const K, V> of the current node
-         */
-        pair_type& operator*() const {return current->data;}
-        /**
-         * pre-increment operator. Implements algorithm for retrieving
+	    for (const auto& x : *this)
+		init = reduce(std::move(init), transform(x));
+	    return init;
+	}
+	/**
+	 * Apply transform to every key-value pair and combine the results with reduce, starting
+	 * from init. Each subtree is reduced by a single thread and the partial results are then
+	 * combined by the calling thread, hence reduce must be associative and commutative.
+	 * @param policy parallel policy giving the number of threads to use
+	 * @param init initial value of the reduction
+	 * @param reduce binary function object combining two T
+	 * @param transform function object mapping a const pair_type& to T
+	 */
+	template <class T, class R, class F>
+	T transform_reduce(const BST_execution::parallel_policy policy, T init, R reduce, F transform) const;
+	/**
+	 * Balance the current BST.
+	 */
+	void balance();
+	/**
+	 * Move all the nodes into a single contiguous block, carved from the regions of
+	 * BST_storage (backed by huge pages in huge_pages mode), in the given order: breadth first,
+	 * so that the top levels share a few cache lines and pages, or van Emde Boas, which keeps
+	 * every subtree of about sqrt(height) levels together and so makes descents touch about
+	 * log(height) blocks whatever the block size. The shape of the tree is unchanged, hence
+	 * the layout is best done after balance; if the regions are not available the nodes are
+	 * reallocated one by one in the same order. Every pair is copied, and the tree is left
+	 * unchanged if a copy throws. Invalidates iterators, cursors and ranges.
+	 * @param order the layout of the nodes, van Emde Boas by default
+	 */
+	void compact(const BST_storage::layout order = BST_storage::layout::van_emde_boas);
+	/**
+	 * Remove all key-value pairs from the BST. Nodes are freed iteratively, hence
+	 * the stack depth does not depend on the height of the tree.
+	 */
+	void clear() noexcept;
+	/**
+	 * Return the number of key-value pairs in the BST.
+	 */
+	size_t size() const noexcept {return node_count;}
+	//!Number of pairs the BST holds inside itself before it moves them to heap nodes
+	static constexpr size_t inline_capacity{N};
+	/**
+	 * Return whether the nodes are stored inside the BST, which is the case from its
+	 * construction or its last clear until it holds more than inline_capacity pairs.
+	 */
+	bool is_inline() const noexcept {
+	    if constexpr (N > 0)
+		return inline_nodes().active;
+	    else
+		return false;
+	}
+	/**
+	 * Return the height of the BST, as the number of nodes on its longest root-to-leaf
+	 * path (0 for an empty tree). Takes linear time, the tree is walked with an explicit stack.
+	 */
+	size_t height() const;
+	//!Shape of the tree, as returned by stats
+	struct stats_type {
+	    //! number of key-value pairs
+	    size_t size;
+	    //! number of nodes on the longest root-to-leaf path
+	    size_t height;
+	    //! average depth of the nodes, the root being at depth 0; a successful find visits depth + 1 nodes
+	    double average_depth;
+	    //! depth of the deepest node, height - 1 for non-empty trees
+	    size_t max_depth;
+	    //! leaf_depths[d] is the number of leaves at depth d
+	    std::vector<size_t> leaf_depths;
+	    //! height over the smallest height of a tree of the same size, ceil(log2(size + 1)); 0 when empty
+	    double height_ratio;
+	};
+	/**
+	 * Return the shape of the tree: size, height, average and maximum depth of the nodes,
+	 * histogram of the depths of the leaves, and ratio of the height to the optimal one.
+	 * Takes linear time, the tree is walked with an explicit stack.
+	 */
+	stats_type stats() const;
+	//!Whether find and insert count the nodes they visit and their comparisons, see probe_stats
+#ifdef BST_PROBE_COUNTERS
+	static constexpr bool probing{true};
+#else
+	static constexpr bool probing{false};
+#endif
+	//!Work done by find and insert since the creation of the tree or the last reset_probe_stats
+	struct probe_stats_type {
+	    //! number of calls to find (including those made by operator[])
+	    size_t finds;
+	    //! nodes visited and calls to the comparison made by the finds
+	    size_t find_nodes, find_comparisons;
+	    //! number of calls to insert, not counting the ones made by balance
+	    size_t inserts;
+	    //! nodes visited and calls to the comparison made by the inserts
+	    size_t insert_nodes, insert_comparisons;
+	};
+	/**
+	 * Return the counters of the work done by find and insert. They are only kept when
+	 * BST_PROBE_COUNTERS is defined (consistently in every translation unit), since updating
+	 * them costs a few atomic additions per call; otherwise they are all zero. Lookups answered
+	 * by the filter or by the index count as finds visiting no node.
+	 */
+	probe_stats_type probe_stats() const noexcept;
+	/**
+	 * Set the counters returned by probe_stats to zero.
+	 */
+	void reset_probe_stats() noexcept;
+	/**
+	 * Set the policy of automatic rebalancing. insert keeps track of the height of the tree
+	 * and, whenever an insertion makes it exceed policy.factor * log2(size() + 1) while the tree
+	 * holds at least policy.min_size pairs, either calls balance before returning (synchronous
+	 * mode, which then invalidates iterators and cursors) or records that a rebalance is due,
+	 * which is done by the next call to maintain (deferred mode). The new policy is checked
+	 * right away against the current height.
+	 * @param policy the new policy, off by default
+	 */
+	void set_rebalance_policy(const BST_rebalance::policy& policy);
+	/**
+	 * Return the policy of automatic rebalancing.
+	 */
+	const BST_rebalance::policy& rebalance_policy() const noexcept {return rebalancing;}
+	/**
+	 * Return the counters of the automatic rebalancing, along with the height tracked by insert.
+	 */
+	BST_rebalance::stats rebalance_stats() const noexcept {
+
+	    return BST_rebalance::stats{rebalance_triggers, rebalance_count, max_depth, rebalance_pending};
+	}
+	/**
+	 * Do the rebalance recorded as due in deferred mode, if any, and return whether it was done.
+	 * Meant to be called when it is safe to invalidate iterators, e.g. from a maintenance task.
+	 */
+	bool maintain();
+	/**
+	 * Build a hash index mapping every key to its node, which is then kept up to date by
+	 * insert, balance, clear, copies and moves. find and operator[] become O(1) expected,
+	 * while iteration keeps following the tree. Two keys must have the same hash whenever
+	 * they are equivalent according to Comp.
+	 * @tparam Hash function object hashing a key_type
+	 */
+	template <class Hash = std::hash<K>>
+	void enable_index();
+	/**
+	 * Drop the hash index, if any, and release its memory.
+	 */
+	void disable_index() noexcept {
+
+	    index.reset();
+	}
+	/**
+	 * Test whether the hash index is enabled.
+	 */
+	bool indexed() const noexcept {return index != nullptr;}
+	/**
+	 * Return an estimate of the bytes used by the hash index (buckets and entries), 0 when
+	 * it is disabled.
+	 */
+	size_t index_memory() const noexcept {return index ? index->memory() : 0;}
+	//!Counters of the approximate membership filter
+	struct filter_stats_type {
+	    //! number of lookups that queried the filter
+	    size_t queries;
+	    //! number of lookups answered by the filter alone, as the key was surely absent
+	    size_t rejected;
+	    //! size of the filter in bits
+	    size_t bits;
+	};
+	/**
+	 * Build an approximate membership filter (a blocked Bloom filter) on the keys, sized for
+	 * the current number of pairs. Keys are added to it by insert and it is rebuilt, sized for
+	 * the new number of pairs, by balance; in between, the false positive rate grows as pairs
+	 * are added. find checks the filter first, so that most lookups of absent keys end after
+	 * reading a single cache line. Two keys must have the same hash whenever they are
+	 * equivalent according to Comp.
+	 * @tparam Hash function object hashing a key_type
+	 * @param false_positive_rate target probability of a lookup of an absent key passing the filter
+	 */
+	template <class Hash = std::hash<K>>
+	void enable_filter(const double false_positive_rate = 0.01);
+	/**
+	 * Drop the filter, if any, and release its memory.
+	 */
+	void disable_filter() noexcept {
+
+	    filter.reset();
+	}
+	/**
+	 * Return the counters of the filter, all zero when it is disabled.
+	 */
+	filter_stats_type filter_stats() const noexcept {
+
+	    return filter ? filter_stats_type{filter->queries, filter->rejected, filter->bits()} : filter_stats_type{0, 0, 0};
+	}
+	/**
+	 * Let the BST address its nodes directly by key, for integral keys ordered by std::less.
+	 * Whenever balance runs (and right away) the BST checks whether its keys fill at least
+	 * min_density of the range between the smallest and the largest one; if so, it keeps an
+	 * array of pointers to the nodes indexed by key, with an occupancy bitmap, so that find
+	 * takes constant time and visit_inorder, visit_range and export_columns scan the array
+	 * instead of walking the tree. The tree is still maintained, and the array is dropped as
+	 * soon as an insert makes the keys too sparse.
+	 * @param min_density smallest share of the range of the keys that must be in the BST, in [0.01, 1]
+	 */
+	void enable_dense(const double min_density = 0.5);
+	/**
+	 * Drop the direct-addressed array, if any, and release its memory.
+	 */
+	void disable_dense() noexcept {
+
+	    dense.reset();
+	}
+	/**
+	 * Test whether the direct-addressed array is in use.
+	 */
+	bool is_dense() const noexcept {return dense && dense->in_use();}
+	/**
+	 * Return the bytes used by the direct-addressed array, 0 when it is not in use.
+	 */
+	size_t dense_memory() const noexcept {return dense ? dense->memory() : 0;}
+	/**
+         * Overload of the operator[], in const and non-const version
+         */
+	value_type& operator[] (const key_type&);
+	const value_type& operator[] (const key_type&) const;
+
+};
+
+/*
+ * Node struct
+ */
+namespace{
+    template<class K, class V, bool Prefixed>
+    struct BST_node : BST_node_prefix<K, Prefixed> {
+
+	    using pair_type=typename BST<K,V>::pair_type;
+	    using key_type=typename BST<K,V>::key_type;
+	    using value_type=typename BST<K,V>::value_type;
+	    using node_type=BST_node<K,V,Prefixed>;
+
+	    //! Pointers to left and right child of the node
+	    std::unique_ptr<node_type> left_child, right_child;
+	    //! Pointer to the parent of this node
+	    node_type* parent;
+	    //! Key-value pair stored in the node
+	    pair_type data;
+
+	    /**
+	     * Default constructor for BST_node
+	     */
+	    BST_node() = delete;    //delete default constructor
+	    /**
+	     * Create a new node having the given data stored in it and the given parent
+	     * @param key key of the key-value pair to store in the node
+	     * @param value value of the key-value pair to store in the node
+	     * @param father pointer to the parent of the node
+	     */
+	    BST_node(const key_type& key, const value_type& value, node_type* father)
+	     : BST_node_prefix<K, Prefixed>{key}, left_child{nullptr}, right_child{nullptr}, parent{father}, data{key, value}
+	    {}
+	    /**
+	     * Create a new node taking over the given value
+	     */
+	    BST_node(const key_type& key, value_type&& value, node_type* father)
+	     : BST_node_prefix<K, Prefixed>{key}, left_child{nullptr}, right_child{nullptr}, parent{father}, data{key, std::move(value)}
+	    {}
+	    /**
+	     * Default destructor for nodes
+	     */
+	    ~BST_node() noexcept = default;
+	    /**
+	     * Allocation functions, taking nodes from the storage selected through BST_storage::set_mode
+	     */
+	    static void* operator new(const std::size_t size) {
+
+		return BST_storage::pool<sizeof(BST_node), alignof(BST_node)>::allocate(size);
+	    }
+	    static void operator delete(void* p) noexcept {
+
+		BST_storage::pool<sizeof(BST_node), alignof(BST_node)>::deallocate(p);
+	    }
+    };
+}
+
+/*
+ * Iterator class, made compliant with the STL. In particular, the iterator allows to traverse the tree
+ * in-order, that is from the smallest to the greatest key.
+ */
+namespace {
+template<class K, class V, bool Prefixed>
+class BST_iterator : public std::iterator<std::forward_iterator_tag, std::pair<const K,V>>{
+
+        using pair_type = typename BST<K,V>::pair_type;
+        using node_type=BST_node<K,V,Prefixed>;
+        //! a pointer to the node the iterator is currently over
+        node_type* current;
+
+    public:
+        /**
+         * Constructor
+         * @param n the node to initialize current to
+         */
+        BST_iterator(node_type* n) : current{n} {}
+        /**
+         * dereferencing operator, returns an std::pair<const K, V> of the current node
+         */
+        pair_type& operator*() const {return current->data;}
+        /**
+         * pre-increment operator. Implements algorithm for retrieving
          * the successor of a node.
          */
         BST_iterator& operator++() {
@@ -316,10 +1230,10 @@ class BST_iterator : public std::iterator<std::forward_iterator_tag, std::pair<c
  *exception of the dereferencing operator that is const, as appropriate
  */
 namespace {
-template<class K, class V>
-class BST_const_iterator : public BST_iterator<K,V> {
-    using node_type=BST_node<K,V>;
-    using base = ::BST_iterator<K,V>;
+template<class K, class V, bool Prefixed>
+class BST_const_iterator : public BST_iterator<K,V,Prefixed> {
+    using node_type=BST_node<K,V,Prefixed>;
+    using base = ::BST_iterator<K,V,Prefixed>;
     using pair_type = typename BST<K,V>::pair_type;
      public:
         using base::BST_iterator;
@@ -331,98 +1245,1287 @@ class BST_const_iterator : public BST_iterator<K,V> {
 }
 
 
-#ifdef __BST_DEV__
-namespace BST_testing{
-
-    class Tester{
+/*
+ * Range class, made splittable in the spirit of TBB blocked_range. A range spans the pairs
+ * from first (included) to last (excluded) and is split at the topmost node of the tree
+ * lying strictly between them, so that halves follow the structure of the tree.
+ */
+namespace {
+template<class K, class V, class Comp>
+class BST_range {
+
+        using node_type = BST_node<K,V,BST_prefixed<K,Comp>::value>;
+        //! root of the tree the range belongs to
+        node_type* root;
+        //! comparison function of the tree
+        const Comp* compare;
+        //! first node in the range and first node past the range (nullptr for end)
+        node_type *first, *last;
+        //! the range is not divisible once it holds at most grain pairs
+        size_t grain;
+
+    public:
+        using iterator = BST_iterator<K,V,BST_prefixed<K,Comp>::value>;
+        /**
+         * Constructor, ranges are meant to be created through BST::range
+         * @param tree_root root of the tree
+         * @param comp comparison function of the tree
+         * @param begin first node in the range
+         * @param end first node past the range
+         * @param grainsize maximum number of pairs in an indivisible range
+         */
+        BST_range(node_type* tree_root, const Comp* comp, node_type* begin, node_type* end, const size_t grainsize)
+         : root{tree_root}, compare{comp}, first{begin}, last{end}, grain{std::max(grainsize, size_t{1})}
+        {}
+        /**
+         * Splitting constructor, in the style of TBB: this becomes the upper half of other, while
+         * other keeps the lower half. Accepts any tag type, e.g. tbb::split.
+         * @param other range to split
+         */
+        template<class Split>
+        BST_range(BST_range& other, Split) : BST_range{other.split()} {}
+        /**
+         * begin and end return iterators to the first node in the range and past the range.
+         */
+        iterator begin() const noexcept {return iterator{first};}
+        iterator end() const noexcept {return iterator{last};}
+        /**
+         * Test whether the range holds no pairs.
+         */
+        bool empty() const noexcept {return first == last;}
+        /**
+         * Test whether the range holds more than grain pairs, hence can be split. Costs at most
+         * grain iterator increments.
+         */
+        bool is_divisible() const {
+            iterator it{first}, stop{last};
+            for (size_t i{0}; i < grain; ++i) {
+                if (it == stop) return false;
+                ++it;
+            }
+            return it != stop;
+        }
+        /**
+         * Split the range: this keeps the pairs below the topmost node lying strictly between
+         * first and last, while a range starting at that node is returned. The range must be
+         * divisible.
+         */
+        BST_range split() {
+            node_type* current{root};
+            while (current) {    //descend until a key lies strictly inside (first, last)
+                if (!(*compare)(first->data.first, current->data.first))
+                    current = current->right_child.get();
+                else if (last && !(*compare)(current->data.first, last->data.first))
+                    current = current->left_child.get();
+                else
+                    break;
+            }
+            BST_range upper{root, compare, current, last, grain};
+            last = current;
+            return upper;
+        }
+};
+}
+
+
+/*
+ * Cursor class. The cursor keeps the stack of the nodes whose left subtree has already been
+ * handed out, with the next node on top, so that each batch costs no parent pointer climbing.
+ * A cursor is invalidated by insertions, balance and clear; resume through BST::cursor(position()).
+ */
+namespace {
+template<class K, class V, bool Prefixed>
+class BST_cursor {
+
+        using node_type = BST_node<K,V,Prefixed>;
+        //! nodes still to hand out, along with their right subtrees; the next one is on top
+        std::vector<node_type*> stack;
+
+    public:
+        //! Alias for the entries handed out, a pointer to a key and one to its value
+        using entry_type = std::pair<const K*, V*>;
+        /**
+         * Constructor, cursors are meant to be created through BST::cursor
+         * @param nodes stack of nodes to start from
+         */
+        explicit BST_cursor(std::vector<node_type*>&& nodes) : stack{std::move(nodes)} {}
+        /**
+         * Fill the given buffer with the next key-value pairs.
+         * @param buffer array able to store at least n entries
+         * @param n maximum number of entries to write
+         * @return number of entries written, less than n only when the cursor is exhausted
+         */
+        size_t next(entry_type* buffer, const size_t n) {
+            size_t count{0};
+            while (count < n && !stack.empty()) {
+                node_type* current{stack.back()};
+                stack.pop_back();
+                buffer[count++] = entry_type{&current->data.first, &current->data.second};
+                for (node_type* child{current->right_child.get()}; child; child = child->left_child.get()) {
+                    BST_PREFETCH(child->right_child.get());
+                    stack.push_back(child);    //push the left spine of the right subtree
+                }
+            }
+            return count;
+        }
+        /**
+         * Test whether every pair has been handed out.
+         */
+        bool done() const noexcept {return stack.empty();}
+        /**
+         * Return a pointer to the key of the next pair to be handed out, nullptr if the cursor
+         * is done. Saving the pointed key allows to resume later through BST::cursor(key).
+         */
+        const K* position() const noexcept {return stack.empty() ? nullptr : &stack.back()->data.first;}
+};
+}
+
+
+/*
+ * Index classes. BST holds the index through the BST_index interface, so that the hash table
+ * (and hence a hash function for key_type) is only instantiated when enable_index is called.
+ */
+namespace {
+template<class K, class V, bool Prefixed>
+class BST_index {
+
+    protected:
+        using node_type = BST_node<K,V,Prefixed>;
+
+    public:
+        virtual ~BST_index() = default;
+        //! Return the node having the given key, nullptr if there is none
+        virtual node_type* find(const K& key) const noexcept = 0;
+        //! Map the key of the given node to the node
+        virtual void insert(node_type* node) = 0;
+        //! Remove all the entries
+        virtual void clear() noexcept = 0;
+        //! Return a new, empty index of the same type
+        virtual std::unique_ptr<BST_index> clone_empty() const = 0;
+        //! Return an estimate of the bytes used by the index
+        virtual size_t memory() const noexcept = 0;
+};
+
+template<class K, class V, class Comp, class Hash>
+class BST_hash_index : public BST_index<K,V,BST_prefixed<K,Comp>::value> {
+
+        using base = BST_index<K,V,BST_prefixed<K,Comp>::value>;
+        using node_type = typename base::node_type;
+        //! hashes the key pointed to
+        struct key_hash {
+            Hash hash;
+            size_t operator()(const K* key) const {return hash(*key);}
+        };
+        //! tests whether the pointed keys are equivalent according to Comp
+        struct key_equal {
+            Comp compare;
+            bool operator()(const K* a, const K* b) const {return !compare(*a, *b) && !compare(*b, *a);}
+        };
+        //! entries point to the keys stored in the nodes, so keys are not duplicated
+        std::unordered_map<const K*, node_type*, key_hash, key_equal> table;
+
+    public:
+        /**
+         * Constructor
+         * @param compare comparison function of the tree
+         */
+        explicit BST_hash_index(const Comp& compare) : table{0, key_hash{}, key_equal{compare}} {}
+        node_type* find(const K& key) const noexcept override {
+            auto it = table.find(&key);
+            return it == table.end() ? nullptr : it->second;
+        }
+        void insert(node_type* node) override {table.emplace(&node->data.first, node);}
+        void clear() noexcept override {table.clear();}
+        std::unique_ptr<base> clone_empty() const override {
+            return std::unique_ptr<base>{new BST_hash_index{table.key_eq().compare}};
+        }
+        size_t memory() const noexcept override {    //a bucket pointer, plus next pointer, entry and cached hash per element
+            return table.bucket_count() * sizeof(void*) + table.size() * (sizeof(void*) + sizeof(std::pair<const K*, node_type*>) + sizeof(size_t));
+        }
+};
+}
+
+
+/*
+ * Filter classes. As for the index, BST holds the filter through an interface, so that a hash
+ * function for key_type is only needed when enable_filter is called.
+ */
+namespace {
+template<class K>
+class BST_filter {
+
+    public:
+        //! number of queries and of queries answered negatively, updated by may_contain (atomic, as lookups may run concurrently)
+        mutable std::atomic<size_t> queries{0}, rejected{0};
+
+        BST_filter() = default;
+        BST_filter(const BST_filter& other) : queries{other.queries.load()}, rejected{other.rejected.load()} {}
+        virtual ~BST_filter() = default;
+        //! Return false if the key is surely not in the set, true if it might be
+        virtual bool may_contain(const K& key) const noexcept = 0;
+        //! Add the key to the set
+        virtual void insert(const K& key) noexcept = 0;
+        //! Remove all the keys from the set
+        virtual void clear() noexcept = 0;
+        //! Remove all the keys and resize the filter for the given number of keys
+        virtual void reset(const size_t capacity) = 0;
+        //! Return a copy of the filter, with the same keys
+        virtual std::unique_ptr<BST_filter> clone() const = 0;
+        //! Return the size of the filter in bits
+        virtual size_t bits() const noexcept = 0;
+};
+
+template<class K, class Hash>
+class BST_bloom_filter : public BST_filter<K> {
+
+        //! each block is a 512 bits cache line, all the probes for a key fall in the same block
+        static constexpr size_t block_words{8};
+        //! target false positive rate
+        double rate;
+        //! number of bits set per key
+        unsigned probes{1};
+        //! the blocks, stored contiguously
+        std::vector<std::uint64_t> words;
+        Hash hash;
+
+        /**
+         * Finalizer of splitmix64, spreads the bits of hashes such as the identity std::hash<size_t>
+         */
+        static std::uint64_t mix(std::uint64_t h) noexcept {
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            return h ^ (h >> 31);
+        }
+        /**
+         * Call f on the index of the word and on the mask of every bit probed for the given key
+         */
+        template<class F>
+        void probe(const K& key, F f) const noexcept {
+            const std::uint64_t h{mix(hash(key))};
+            const size_t block{static_cast<size_t>(h % (words.size() / block_words)) * block_words};
+            const std::uint32_t a{static_cast<std::uint32_t>(h >> 32)}, b{static_cast<std::uint32_t>(mix(h)) | 1u};
+            for (unsigned i{0}; i < probes; ++i) {    //double hashing inside the block
+                const std::uint32_t bit{(a + i * b) & 511u};
+                if (!f(block + (bit >> 6), std::uint64_t{1} << (bit & 63)))
+                    return;
+            }
+        }
+
+    public:
+        /**
+         * Constructor
+         * @param false_positive_rate target false positive rate
+         */
+        explicit BST_bloom_filter(const double false_positive_rate)
+         : rate{std::min(std::max(false_positive_rate, 1e-9), 0.5)}, words(block_words, 0), hash{}
+        {}
+        bool may_contain(const K& key) const noexcept override {
+            this->queries.fetch_add(1, std::memory_order_relaxed);
+            bool found{true};
+            probe(key, [&](const size_t word, const std::uint64_t mask) { return found = (words[word] & mask) != 0; });
+            if (!found)
+                this->rejected.fetch_add(1, std::memory_order_relaxed);
+            return found;
+        }
+        void insert(const K& key) noexcept override {
+            probe(key, [this](const size_t word, const std::uint64_t mask) { words[word] |= mask; return true; });
+        }
+        void clear() noexcept override {std::fill(words.begin(), words.end(), 0);}
+        void reset(const size_t capacity) override {    //m = -n ln(p) / ln(2)^2 bits and k = m / n ln(2) probes
+            const double n{static_cast<double>(std::max(capacity, size_t{64}))};
+            const double m{-n * std::log(rate) / (std::log(2.0) * std::log(2.0))};
+            const size_t blocks{std::max(size_t{1}, static_cast<size_t>(std::ceil(m / 512)))};
+            probes = static_cast<unsigned>(std::min(16.0, std::max(1.0, std::round(m / n * std::log(2.0)))));
+            words.assign(blocks * block_words, 0);
+        }
+        std::unique_ptr<BST_filter<K>> clone() const override {
+            return std::unique_ptr<BST_filter<K>>{new BST_bloom_filter{*this}};
+        }
+        size_t bits() const noexcept override {return words.size() * 64;}
+};
+}
+
+
+/*
+ * Dense class, a direct-addressed array of the nodes of a BST with integral keys, in use only
+ * while the keys fill a large enough share of the range between the smallest and the largest.
+ * Offsets are computed modulo 2^64, so that keys below the first slot fall past the last one.
+ */
+namespace {
+template<class K, class V>
+class BST_dense {
+
+        using node_type = BST_node<K,V>;
+        //! smallest share of the range of the keys that must be in the tree for the array to be used
+        double min_density;
+        //! whether the array is in use
+        bool active{false};
+        //! key of the first slot, smallest and largest key in the tree
+        K base{}, first{}, last{};
+        //! nodes by offset of their key from base, nullptr where the key is not in the tree
+        std::vector<node_type*> slots;
+        //! occupancy bitmap of the slots, lookups of absent keys and scans read it first
+        std::vector<std::uint64_t> occupied;
+
+        static size_t distance(const K from, const K to) noexcept {
+            return static_cast<size_t>(to) - static_cast<size_t>(from);
+        }
+        //! whether count keys spanning [lo, hi] are dense enough, a span of 2^64 keys never is
+        bool dense(const size_t count, const K lo, const K hi) const noexcept {
+            const size_t span{distance(lo, hi) + 1};
+            return span != 0 && count >= min_density * static_cast<double>(span);
+        }
+        void set(const size_t i, node_type* node) noexcept {
+            slots[i] = node;
+            occupied[i >> 6] |= std::uint64_t{1} << (i & 63);
+        }
+
+    public:
+        /**
+         * Constructor
+         * @param density smallest share of the range of the keys that must be in the tree
+         */
+        explicit BST_dense(const double density) : min_density{std::min(std::max(density, 0.01), 1.0)} {}
+        bool in_use() const noexcept {return active;}
+        double density() const noexcept {return min_density;}
+        node_type* find(const K key) const noexcept {
+            const size_t i{distance(base, key)};
+            if (i >= slots.size() || !(occupied[i >> 6] >> (i & 63) & 1))
+                return nullptr;
+            return slots[i];
+        }
+        /**
+         * Make room for count keys in [lo, hi] if they are dense enough, and return whether
+         * they are; the nodes are then added through add. The array is left unused if it cannot
+         * be allocated.
+         */
+        bool reset(const size_t count, const K lo, const K hi) noexcept {
+            clear();
+            if (!dense(count, lo, hi))
+                return false;
+            try {
+                slots.assign(distance(lo, hi) + 1, nullptr);
+                occupied.assign(slots.size() / 64 + 1, 0);
+            }
+            catch (const std::bad_alloc&) {
+                clear();
+                return false;
+            }
+            active = true;
+            base = first = lo;
+            last = hi;
+            return true;
+        }
+        /**
+         * Add the node of a new key, count being the number of keys in the tree with it. Keys
+         * past the last slot extend the array at the amortized cost of a vector, keys before
+         * the first one move the slots up by as much again as needed; the array is dropped if
+         * the keys are not dense enough anymore.
+         */
+        void add(node_type* node, const size_t count) noexcept {
+            const K key{node->data.first};
+            size_t i{distance(base, key)};
+            if (i < slots.size()) {    //a key in the free slots left below first by a shift widens the range as well
+                if (key < first || key > last) {
+                    if (!dense(count, std::min(first, key), std::max(last, key))) {
+                        clear();
+                        return;
+                    }
+                    first = std::min(first, key);
+                    last = std::max(last, key);
+                }
+            }
+            else {
+                const K lo{std::min(first, key)}, hi{std::max(last, key)};
+                if (!dense(count, lo, hi)) {
+                    clear();
+                    return;
+                }
+                try {
+                    if (key > last) {
+                        slots.resize(i + 1, nullptr);
+                        occupied.resize(slots.size() / 64 + 1, 0);
+                    }
+                    else {    //the new base leaves as many free slots below key as there were slots, or as there are keys
+                        const size_t shift{distance(key, base) + std::min(slots.size(), distance(std::numeric_limits<K>::min(), key))};
+                        std::vector<node_type*> moved(slots.size() + shift, nullptr);
+                        std::copy(slots.begin(), slots.end(), moved.begin() + shift);
+                        slots.swap(moved);
+                        occupied.assign(slots.size() / 64 + 1, 0);
+                        for (size_t j{shift}; j < slots.size(); ++j)
+                            if (slots[j])
+                                occupied[j >> 6] |= std::uint64_t{1} << (j & 63);
+                        base = static_cast<K>(static_cast<size_t>(base) - shift);
+                        i = distance(base, key);
+                    }
+                }
+                catch (const std::bad_alloc&) {
+                    clear();
+                    return;
+                }
+                first = lo;
+                last = hi;
+            }
+            set(i, node);
+        }
+        //! Add the node of a key in [first, last], the slots having been sized by reset
+        void place(node_type* node) noexcept {set(distance(base, node->data.first), node);}
+        //! Drop the array and release its memory
+        void clear() noexcept {
+            active = false;
+            std::vector<node_type*>{}.swap(slots);
+            std::vector<std::uint64_t>{}.swap(occupied);
+        }
+        /**
+         * Call f on the nodes having keys in [*lo, *hi), in-order, by a scan of the bitmap and
+         * of the slots. A null bound stands for no bound.
+         */
+        template<class F>
+        void scan(const K* lo, const K* hi, F& f) const {
+            size_t begin{0}, end{slots.size()};
+            if (lo && *lo > base)
+                begin = std::min(distance(base, *lo), end);
+            if (hi)
+                end = *hi > base ? std::min(distance(base, *hi), end) : 0;
+            for (size_t i{begin}; i < end; ++i) {
+                const std::uint64_t word{occupied[i >> 6]};
+                if (word == 0) {    //no key in the rest of the word
+                    i |= 63;
+                    continue;
+                }
+                if (word >> (i & 63) & 1)
+                    f(*slots[i]);
+            }
+        }
+        //! Return the bytes taken by the slots and the bitmap
+        size_t memory() const noexcept {
+            return slots.capacity() * sizeof(node_type*) + occupied.capacity() * sizeof(std::uint64_t);
+        }
+};
+}
+
+
+#ifdef __BST_DEV__
+namespace BST_testing{
+
+    class Tester{
+
+        std::vector<std::pair<int,std::string>> init_test() const;
+        using bst_type = BST<int, std::string>;
+	public:
+
+	    Tester() = default;
+
+	    //!Perform all available tests on BSTs, and return whether they all passed.
+	    bool test() const;
+	    //!Test the default constructor of BST.
+	    bool bst_default_ctor() const noexcept;
+	    //!Test the insertion of elements in a BST.
+	    bool bst_insert() const;
+	    //!Test the copy constructor of BST.
+	    bool bst_copy_ctor() const;
+	    //!Test that the copy constructor of BST performs deep copies.
+	    bool bst_deep_copy() const;
+	    //!Test the move constructor of BST.
+	    bool bst_move_ctor() const;
+	    //!Test copy and move assignments of BST.
+            bool test_move_copy_assignment() const;
+	    //!Test the balance function of BST.
+	    bool bst_balance() const;
+	    //!Test BST iterators.
+	    bool test_iterator() const;
+	    //!Test the find function of BST.
+	    bool test_find() const;
+	    //!Test the clear function of BST.
+            bool test_clear() const;
+	    //!Test copy and teardown of degenerate (linked list shaped) BSTs.
+	    bool test_deep_tree() const;
+	    //!Test the sequential and parallel for_each and transform_reduce functions.
+	    bool test_parallel() const;
+	    //!Test splittable ranges and parallel range scans.
+	    bool test_range() const;
+	    //!Test the visit_inorder and visit_range functions.
+	    bool test_visit() const;
+	    //!Test batch cursors and their resumption.
+	    bool test_cursor() const;
+	    //!Test the size function and the columnar export of BST.
+	    bool test_export_columns() const;
+	    //!Test the optional hash index of BST.
+	    bool test_index() const;
+	    //!Test the optional approximate membership filter of BST.
+	    bool test_filter() const;
+	    //!Test frozen snapshots with front-coded string keys.
+	    bool test_frozen() const;
+	    //!Test key prefixes cached in the nodes of string-keyed BSTs.
+	    bool test_key_prefix() const;
+	    /**
+	     * Test the height of the tree, on degenerate and balanced trees
+	     */
+	    bool test_height() const;
+	    /**
+	     * Test the shape statistics and the probe counters
+	     */
+	    bool test_stats() const;
+	    /**
+	     * Test the automatic rebalancing, in synchronous and deferred mode
+	     */
+	    bool test_rebalance() const;
+	    /**
+	     * Test the latency histograms, when compiled in
+	     */
+	    bool test_latency() const;
+	    /**
+	     * Test the complexity contracts on a large tree: optimal height after balance, one
+	     * allocation per node when copying, lookups bounded by the height, no copies of the keys
+	     */
+	    bool test_complexity() const;
+	    /**
+	     * Test the node storage modes, including nodes freed by other threads
+	     */
+	    bool test_storage() const;
+	    /**
+	     * Test the relayout of the nodes in breadth first and van Emde Boas order
+	     */
+	    bool test_compact() const;
+	    /**
+	     * Test the inline storage of small trees, and their move to heap nodes as they grow
+	     */
+	    bool test_inline() const;
+	    /**
+	     * Test the direct-addressed array of the nodes of trees with dense integral keys
+	     */
+	    bool test_dense() const;
+    };
+}
+#endif
+
+/*
+ * get_min function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::node_type* BST<K,V,Comp,N>::get_min() const noexcept {
+    if (root == nullptr) return nullptr; //if the tree is empty, return nullptr
+    node_type* current{root.get()};
+    while (current->left_child.get()) {   //do down to the left as much as possible
+        current = current->left_child.get();
+    }
+    return current;
+}
+
+/*
+ * split function
+ */
+template<class K, class V, class Comp, std::size_t N>
+std::vector<typename BST<K,V,Comp,N>::node_type*> BST<K,V,Comp,N>::split(const unsigned threads, std::vector<node_type*>& top) const {
+
+    const size_t cutoff{cutoff_depth(threads)};
+    std::vector<node_type*> subtrees;
+    std::vector<std::pair<node_type*, size_t>> stack; //nodes still to visit, along with their depth
+    if (root)
+	stack.push_back({root.get(), 0});
+    while (!stack.empty()) {
+
+	auto current = stack.back();
+	stack.pop_back();
+	if (current.second == cutoff) { //the whole subtree goes to a single thread
+	    subtrees.push_back(current.first);
+	    continue;
+	}
+	top.push_back(current.first);
+	if (current.first->right_child)
+	    stack.push_back({current.first->right_child.get(), current.second + 1});
+	if (current.first->left_child)
+	    stack.push_back({current.first->left_child.get(), current.second + 1});
+    }
+    return subtrees;
+}
+
+/*
+ * split_inorder function
+ */
+template<class K, class V, class Comp, std::size_t N>
+std::vector<std::pair<typename BST<K,V,Comp,N>::node_type*, bool>> BST<K,V,Comp,N>::split_inorder(const unsigned threads) const {
+
+    const size_t cutoff{cutoff_depth(threads)};
+    std::vector<std::pair<node_type*, bool>> pieces;
+    std::vector<std::pair<node_type*, size_t>> stack; //nodes whose left subtree is being visited, along with their depth
+    std::pair<node_type*, size_t> current{root.get(), 0};
+    while (current.first || !stack.empty()) {
+
+	while (current.first) { //go down to the left until the cutoff depth
+	    if (current.second == cutoff) {
+		pieces.push_back({current.first, true});
+		current.first = nullptr;
+	    }
+	    else {
+		stack.push_back(current);
+		current = {current.first->left_child.get(), current.second + 1};
+	    }
+	}
+	if (stack.empty())
+	    break;
+	current = stack.back();
+	stack.pop_back();
+	pieces.push_back({current.first, false});
+	current = {current.first->right_child.get(), current.second + 1};
+    }
+    return pieces;
+}
+
+/*
+ * cutoff_depth function
+ */
+template<class K, class V, class Comp, std::size_t N>
+size_t BST<K,V,Comp,N>::cutoff_depth(const unsigned threads) noexcept {
+
+    size_t cutoff{0};
+    while ((size_t{1} << cutoff) < size_t{8} * threads) //about eight subtrees per thread
+	++cutoff;
+    return cutoff;
+}
+
+/*
+ * height function
+ */
+template<class K, class V, class Comp, std::size_t N>
+size_t BST<K,V,Comp,N>::height() const{
+
+    size_t result{0};
+    if (!root)
+	return result;
+    std::vector<std::pair<const node_type*, size_t>> stack{{root.get(), 1}}; //nodes along with their depth
+    while (!stack.empty()) {
+
+	const auto current = stack.back();
+	stack.pop_back();
+	result = std::max(result, current.second);
+	if (current.first->left_child)
+	    stack.push_back({current.first->left_child.get(), current.second + 1});
+	if (current.first->right_child)
+	    stack.push_back({current.first->right_child.get(), current.second + 1});
+    }
+    return result;
+}
+
+/*
+ * stats function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::stats_type BST<K,V,Comp,N>::stats() const{
+
+    stats_type result{node_count, 0, 0, 0, {}, 0};
+    if (!root)
+	return result;
+    size_t total_depth{0};
+    std::vector<std::pair<const node_type*, size_t>> stack{{root.get(), 0}}; //nodes along with their depth
+    while (!stack.empty()) {
+
+	const auto current = stack.back();
+	stack.pop_back();
+	total_depth += current.second;
+	result.max_depth = std::max(result.max_depth, current.second);
+	if (!current.first->left_child && !current.first->right_child) { //a leaf
+	    if (result.leaf_depths.size() <= current.second)
+		result.leaf_depths.resize(current.second + 1);
+	    ++result.leaf_depths[current.second];
+	}
+	if (current.first->left_child)
+	    stack.push_back({current.first->left_child.get(), current.second + 1});
+	if (current.first->right_child)
+	    stack.push_back({current.first->right_child.get(), current.second + 1});
+    }
+    result.height = result.max_depth + 1;
+    result.average_depth = static_cast<double>(total_depth) / node_count;
+    result.height_ratio = result.height / std::ceil(std::log2(node_count + 1.0));
+    return result;
+}
+
+/*
+ * visit_subtree function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::visit_subtree(node_type& subtree, F& f){
+
+    std::vector<node_type*> stack{&subtree};
+    while (!stack.empty()) {
+
+	node_type* current{stack.back()};
+	stack.pop_back();
+	f(*current);
+	if (current->right_child) //push right first, so that the left subtree is visited first
+	    stack.push_back(current->right_child.get());
+	if (current->left_child)
+	    stack.push_back(current->left_child.get());
+    }
+}
+
+/*
+ * run_parallel function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class T, class F>
+void BST<K,V,Comp,N>::run_parallel(const unsigned threads, std::vector<T>& tasks, F f){
+
+    const size_t workers{std::max(size_t{1}, std::min(size_t{threads}, tasks.size()))};
+    std::atomic<size_t> next{0}; //index of the next task to be processed
+    std::vector<std::exception_ptr> errors(workers);
+    auto work = [&](const size_t id) {
+	try {
+	    for (size_t i{next++}; i < tasks.size(); i = next++)
+		f(tasks[i], i);
+	}
+	catch (...) {
+	    errors[id] = std::current_exception();
+	}
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t id{1}; id < workers; ++id)
+	pool.emplace_back(work, id);
+    work(0); //the calling thread takes part in the work too
+    for (auto& t : pool)
+	t.join();
+    for (auto& e : errors)
+	if (e)
+	    std::rethrow_exception(e);
+}
+
+/*
+ * for_each function (parallel version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::for_each(const BST_execution::parallel_policy policy, F f){
+
+    if (node_count < policy.cutoff)
+	return for_each(BST_execution::seq, f);
+    const unsigned threads{policy.threads ? policy.threads : std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<node_type*> top;
+    auto subtrees = split(threads, top);
+    auto visit = [&f](node_type& n) { f(n.data); };
+    for (auto n : top)
+	visit(*n);
+    run_parallel(threads, subtrees, [&visit](node_type* subtree, size_t) { visit_subtree(*subtree, visit); });
+}
+
+/*
+ * for_each function (const parallel version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::for_each(const BST_execution::parallel_policy policy, F f) const {
+
+    const_cast<BST&>(*this).for_each(policy, [&f](const pair_type& x) { f(x); }); //pairs are only handed out as const
+}
+
+/*
+ * transform_reduce function (parallel version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class T, class R, class F>
+T BST<K,V,Comp,N>::transform_reduce(const BST_execution::parallel_policy policy, T init, R reduce, F transform) const {
+
+    if (node_count < policy.cutoff)
+	return transform_reduce(BST_execution::seq, std::move(init), reduce, transform);
+    const unsigned threads{policy.threads ? policy.threads : std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<node_type*> top;
+    auto subtrees = split(threads, top);
+    std::vector<T> partials; //one partial result per subtree, each seeded with the subtree root
+    partials.reserve(subtrees.size());
+    for (auto n : subtrees)
+	partials.push_back(transform(static_cast<const pair_type&>(n->data)));
+
+    run_parallel(threads, subtrees, [&](node_type* subtree, size_t i) {
+	auto accumulate = [&](node_type& n) {
+	    if (&n != subtree)
+		partials[i] = reduce(std::move(partials[i]), transform(static_cast<const pair_type&>(n.data)));
+	};
+	visit_subtree(*subtree, accumulate);
+    });
+
+    for (auto n : top)
+	init = reduce(std::move(init), transform(static_cast<const pair_type&>(n->data)));
+    for (auto& x : partials)
+	init = reduce(std::move(init), std::move(x));
+    return init;
+}
+
+/*
+ * for_each function (parallel range version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::for_each(const BST_execution::parallel_policy policy, range_type r, F f) const {
+
+    if (node_count < policy.cutoff) //the range holds at most as many pairs as the tree
+	return for_each(BST_execution::seq, r, f);
+    const unsigned threads{policy.threads ? policy.threads : std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<range_type> pieces{r};
+    bool divisible{true};
+    while (divisible && pieces.size() < size_t{8} * threads) { //split every piece in halves, one level at a time
+
+	divisible = false;
+	const size_t count{pieces.size()};
+	for (size_t i{0}; i < count; ++i) {
+	    if (pieces[i].is_divisible()) {
+		pieces.push_back(pieces[i].split());
+		divisible = true;
+	    }
+	}
+    }
+    run_parallel(threads, pieces, [&f](range_type& piece, size_t) {
+	for (auto it = piece.begin(); it != piece.end(); ++it)
+	    f(*it);
+    });
+}
+
+/*
+ * visit function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::visit(node_type* subtree, const key_type* lo, const key_type* hi, F&& f) const {
+
+    std::vector<node_type*> stack; //nodes whose left subtree is being visited
+    stack.reserve(64);
+    node_type* current{subtree};
+    while (current || !stack.empty()) {
+
+	while (current) { //go down to the left as much as possible, skipping keys below lo
+	    if (lo && compare(current->data.first, *lo)) {
+		current = current->right_child.get();
+		continue;
+	    }
+	    BST_PREFETCH(current->right_child.get());
+	    stack.push_back(current);
+	    current = current->left_child.get();
+	}
+	if (stack.empty()) //every remaining key is below lo
+	    return;
+	current = stack.back();
+	stack.pop_back();
+	if (hi && !compare(current->data.first, *hi)) //every remaining key is not less than hi
+	    return;
+	f(*current);
+	current = current->right_child.get();
+    }
+}
+
+/*
+ * visit_ordered function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class F>
+void BST<K,V,Comp,N>::visit_ordered(const key_type* lo, const key_type* hi, F&& f) const {
+
+    if constexpr (densable) {
+	if (dense && dense->in_use()) {
+	    dense->scan(lo, hi, f);
+	    return;
+	}
+    }
+    visit(root.get(), lo, hi, std::forward<F>(f));
+}
+
+/*
+ * densify function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::densify() noexcept {
+
+    if constexpr (densable) {
+	if (!dense)
+	    return;
+	if (!root) {
+	    dense->clear();
+	    return;
+	}
+	const node_type* last{root.get()};
+	while (last->right_child)
+	    last = last->right_child.get();
+	if (!dense->reset(node_count, get_min()->data.first, last->data.first))
+	    return;
+	auto place = [this](node_type& n) { dense->place(&n); };
+	visit_subtree(*root, place);
+    }
+}
+
+/*
+ * add_dense function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::add_dense(node_type* node) noexcept {
+
+    if constexpr (densable) {
+	if (dense && dense->in_use())
+	    dense->add(node, node_count);
+    }
+    else
+	(void)node;
+}
+
+/*
+ * export_columns function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::export_columns(std::vector<key_type>& keys, std::vector<value_type>& values) const {
+
+    keys.resize(node_count);
+    values.resize(node_count);
+    size_t i{0};
+    visit_ordered(nullptr, nullptr, [&](const node_type& n) {
+	keys[i] = n.data.first;
+	values[i++] = n.data.second;
+    });
+}
+
+/*
+ * export_columns function (parallel version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::export_columns(const BST_execution::parallel_policy policy, std::vector<key_type>& keys, std::vector<value_type>& values) const {
+
+    if (node_count < policy.cutoff)
+	return export_columns(keys, values);
+    const unsigned threads{policy.threads ? policy.threads : std::max(1u, std::thread::hardware_concurrency())};
+    auto pieces = split_inorder(threads);
+    std::vector<size_t> subtrees, offsets(pieces.size() + 1, 0); //offsets[i] is where the i-th piece starts
+    for (size_t i{0}; i < pieces.size(); ++i)
+	if (pieces[i].second)
+	    subtrees.push_back(i);
+
+    run_parallel(threads, subtrees, [&](size_t piece, size_t) { //count the nodes of every subtree
+	size_t count{0};
+	auto increment = [&count](node_type&) { ++count; };
+	visit_subtree(*pieces[piece].first, increment);
+	offsets[piece + 1] = count;
+    });
+    for (size_t i{0}; i < pieces.size(); ++i)
+	offsets[i + 1] = offsets[i] + (pieces[i].second ? offsets[i + 1] : 1);
+
+    keys.resize(offsets.back());
+    values.resize(offsets.back());
+    for (size_t i{0}; i < pieces.size(); ++i) {
+	if (!pieces[i].second) {
+	    keys[offsets[i]] = pieces[i].first->data.first;
+	    values[offsets[i]] = pieces[i].first->data.second;
+	}
+    }
+    run_parallel(threads, subtrees, [&](size_t piece, size_t) { //write every subtree in-order at its offset
+	size_t i{offsets[piece]};
+	visit(pieces[piece].first, nullptr, nullptr, [&](const node_type& n) {
+	    keys[i] = n.data.first;
+	    values[i++] = n.data.second;
+	});
+    });
+}
+
+/*
+ * export_columns function (range version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::export_columns(const key_type& lo, const key_type& hi, std::vector<key_type>& keys, std::vector<value_type>& values) const {
+
+    keys.clear();
+    values.clear();
+    visit_ordered(&lo, &hi, [&](const node_type& n) {
+	keys.push_back(n.data.first);
+	values.push_back(n.data.second);
+    });
+}
+
+/*
+ * cursor function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::cursor_type BST<K,V,Comp,N>::cursor() const {
+
+    std::vector<node_type*> stack;
+    for (node_type* current{root.get()}; current; current = current->left_child.get())
+	stack.push_back(current); //push the left spine, the smallest key ends up on top
+    return cursor_type{std::move(stack)};
+}
+
+/*
+ * cursor function (resuming version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::cursor_type BST<K,V,Comp,N>::cursor(const key_type& from) const {
+
+    std::vector<node_type*> stack;
+    node_type* current{root.get()};
+    while (current) { //push the nodes not less than from along the path to its lower bound
+	if (compare(current->data.first, from)) {
+	    current = current->right_child.get();
+	}
+	else {
+	    stack.push_back(current);
+	    current = current->left_child.get();
+	}
+    }
+    return cursor_type{std::move(stack)};
+}
+
+/*
+ * lower_bound function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::node_type* BST<K,V,Comp,N>::lower_bound(const key_type& key) const noexcept {
+    node_type* current{root.get()};
+    node_type* candidate{nullptr};
+    while (current) {
+        if (compare(current->data.first, key)) {    //current key is smaller, the bound is in the right subtree
+            current = current->right_child.get();
+        }
+        else {    //current key is a candidate, look for a smaller one in the left subtree
+            candidate = current;
+            current = current->left_child.get();
+        }
+    }
+    return candidate;
+}
+
+/*
+ * enable_index function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class Hash>
+void BST<K,V,Comp,N>::enable_index(){
 
-        std::vector<std::pair<int,std::string>> init_test() const;
-        using bst_type = BST<int, std::string>;
-	public:
+    index.reset(new BST_hash_index<K,V,Comp,Hash>{compare});
+    if (!is_inline()) //inline nodes are found by a scan, the index is filled when they move to the heap
+	visit(root.get(), nullptr, nullptr, [this](node_type& n) { index->insert(&n); });
+}
 
-	    Tester() = default;
+/*
+ * enable_filter function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class Hash>
+void BST<K,V,Comp,N>::enable_filter(const double false_positive_rate){
 
-	    //!Perform all available tests on BSTs.
-	    void test() const;
-	    //!Test the default constructor of BST.
-	    bool bst_default_ctor() const noexcept;
-	    //!Test the insertion of elements in a BST.
-	    bool bst_insert() const;
-	    //!Test the copy constructor of BST.
-	    bool bst_copy_ctor() const;
-	    //!Test that the copy constructor of BST performs deep copies.
-	    bool bst_deep_copy() const;
-	    //!Test the move constructor of BST.
-	    bool bst_move_ctor() const;
-	    //!Test copy and move assignments of BST.
-            bool test_move_copy_assignment() const;
-	    //!Test the balance function of BST.
-	    bool bst_balance() const;
-	    //!Test BST iterators.
-	    bool test_iterator() const;
-	    //!Test the find function of BST.
-	    bool test_find() const;
-	    //!Test the clear function of BST.
-            bool test_clear() const;
-    };
+    filter.reset(new BST_bloom_filter<K,Hash>{false_positive_rate});
+    filter->reset(node_count);
+    visit(root.get(), nullptr, nullptr, [this](node_type& n) { filter->insert(n.data.first); });
 }
-#endif
 
 /*
- * get_min function
+ * enable_dense function
  */
-template<class K, class V, class Comp>
-typename BST<K,V,Comp>::node_type* BST<K,V,Comp>::get_min() const noexcept {
-    if (root == nullptr) return nullptr; //if the tree is empty, return nullptr
-    node_type* current{root.get()};
-    while (current->left_child.get()) {   //do down to the left as much as possible
-        current = current->left_child.get();
-    }
-    return current;
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::enable_dense(const double min_density){
+
+    static_assert(densable, "direct addressing needs integral keys ordered by std::less");
+    dense.reset(new BST_dense<K,V>{min_density});
+    densify();
 }
 
 /*
  * find function
  */
-template<class K, class V, class Comp>
-typename BST<K,V,Comp>::iterator BST<K,V,Comp>::find(const key_type key) const noexcept {
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::iterator BST<K,V,Comp,N>::find(const key_type& key) const noexcept {
+    BST_LATENCY_TIMER(find);
+    BST_probe probe{};
+    if constexpr (densable) {
+        if (dense && dense->in_use()) {    //a single lookup in the array, nullptr (that is end()) if the key is not there
+            count_find(probe);
+            return iterator{dense->find(key)};
+        }
+    }
+    if (filter && !filter->may_contain(key)) {    //the key is surely not in the tree
+        count_find(probe);
+        return end();
+    }
+    if (index && !is_inline()) {    //a single hash lookup, nullptr (that is end()) if the key is not there
+        count_find(probe);
+        return iterator{index->find(key)};
+    }
+    const std::uint64_t prefix{prefix_of(key)};
+    if constexpr (N > 0) {
+        if (inline_nodes().active) {    //a scan of the sorted slots, nullptr if the key is not there
+            size_t position{0};
+            node_type* node{find_inline(key, prefix, position, probe)};
+            count_find(probe);
+            return iterator{node};
+        }
+    }
     node_type* current{root.get()};
     while (current) {
-        key_type curr_key = current->data.first;
-        if (!compare(curr_key, key) && !compare(key, curr_key)) {   //if current node has sought-after key, return an iterator to it
+        probe.node();
+        const int direction{order(key, prefix, *current, probe)};
+        if (direction == 0) {   //if current node has sought-after key, return an iterator to it
+            count_find(probe);
             return iterator{current};
         }
-        else if (compare(key, curr_key)) {    //if greater, proceed in the left subtree
+        else if (direction < 0) {    //if greater, proceed in the left subtree
             current = current->left_child.get();
         }
         else {    //if smaller, proceed in the right subtree
             current = current->right_child.get();
         }
     }
+    count_find(probe);
     return end();    //if not found, return end
 }
 
+/*
+ * prefix_of function
+ */
+template<class K, class V, class Comp, std::size_t N>
+std::uint64_t BST<K,V,Comp,N>::prefix_of(const key_type& key) noexcept {
+    if constexpr (prefixed) {
+        return BST_key_prefix<K>::get(key);
+    }
+    else {
+        (void)key;
+        return 0;
+    }
+}
+
+/*
+ * order function
+ */
+template<class K, class V, class Comp, std::size_t N>
+int BST<K,V,Comp,N>::order(const key_type& key, const std::uint64_t prefix, const node_type& node, BST_probe& probe) const {
+    if constexpr (prefixed) {    //prefixes are stored inline in the node, no need to touch the key buffer
+        if (prefix != node.key_prefix) {
+            return prefix < node.key_prefix ? -1 : 1;
+        }
+    }
+    (void)prefix;
+    probe.comparison();
+    if (compare(key, node.data.first)) {
+        return -1;
+    }
+    probe.comparison();
+    return compare(node.data.first, key) ? 1 : 0;
+}
+
+/*
+ * count_find function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::count_find(const BST_probe& probe) const noexcept {
+#ifdef BST_PROBE_COUNTERS
+    probes.finds.fetch_add(1, std::memory_order_relaxed);
+    probes.find_nodes.fetch_add(probe.nodes, std::memory_order_relaxed);
+    probes.find_comparisons.fetch_add(probe.comparisons, std::memory_order_relaxed);
+#else
+    (void)probe;
+#endif
+}
+
+/*
+ * count_insert function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::count_insert(const BST_probe& probe) noexcept {
+#ifdef BST_PROBE_COUNTERS
+    probes.inserts.fetch_add(1, std::memory_order_relaxed);
+    probes.insert_nodes.fetch_add(probe.nodes, std::memory_order_relaxed);
+    probes.insert_comparisons.fetch_add(probe.comparisons, std::memory_order_relaxed);
+#else
+    (void)probe;
+#endif
+}
+
+/*
+ * probe_stats function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::probe_stats_type BST<K,V,Comp,N>::probe_stats() const noexcept {
+#ifdef BST_PROBE_COUNTERS
+    return probe_stats_type{probes.finds.load(), probes.find_nodes.load(), probes.find_comparisons.load(),
+			    probes.inserts.load(), probes.insert_nodes.load(), probes.insert_comparisons.load()};
+#else
+    return probe_stats_type{0, 0, 0, 0, 0, 0};
+#endif
+}
+
+/*
+ * reset_probe_stats function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::reset_probe_stats() noexcept {
+#ifdef BST_PROBE_COUNTERS
+    for (auto* counter : {&probes.finds, &probes.find_nodes, &probes.find_comparisons,
+			  &probes.inserts, &probes.insert_nodes, &probes.insert_comparisons})
+	counter->store(0);
+#endif
+}
+
 /*
  * insert function (key_type, value_type version)
  */
-template<class K, class V, class Comp>
-void BST<K,V,Comp>::insert(const key_type& key, const value_type& value){
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::insert(const key_type& key, const value_type& value){
 
+    BST_LATENCY_TIMER(insert);
+    BST_probe probe{};
+    if constexpr (densable) {
+	if (dense && dense->in_use()) { //if the key is already in the array update the value
+	    if (node_type* node = dense->find(key)) {
+		node->data.second = value;
+		count_insert(probe);
+		return;
+	    }
+	}
+    }
+    if (index && !is_inline()) { //if the key is already indexed update the value without descending the tree
+	if (node_type* node = index->find(key)) {
+	    node->data.second = value;
+	    count_insert(probe);
+	    return;
+	}
+    }
+    if (filter)
+	filter->insert(key); //a no-op if the key is already in the tree
+    const std::uint64_t prefix{prefix_of(key)};
+    if constexpr (N > 0) {
+	if (inline_nodes().active) {
+	    size_t position{0};
+	    if (node_type* node = find_inline(key, prefix, position, probe)) { //the key is already in the tree
+		node->data.second = value;
+		count_insert(probe);
+		return;
+	    }
+	    if (node_count < N) {
+		insert_inline(position, key, value);
+		add_dense(&inline_nodes().node(node_count - 1));
+		count_insert(probe);
+		return;
+	    }
+	    grow(); //one pair too many, go on with the nodes on the heap
+	}
+    }
     if (root == nullptr){ //check if the BST is empty
 	root.reset(new node_type{key, value, nullptr});
+	++node_count;
+	max_depth = 1;
+	if (index)
+	    index->insert(root.get());
+	add_dense(root.get());
+	count_insert(probe);
 	return;
     }
 
     node_type *previous_node{root.get()}; //initialize previous node to root
     node_type *current_node{root.get()}; //initilize also the current node ptr to root
+    int direction{0};
+    size_t depth{1}; //depth of the new node, counting the root as 1
     while (current_node) {
 
-	key_type current_key{current_node->data.first};
-        if (!compare(current_key, key) && !compare(key, current_key)) { //if the key is already in the tree update the value
+	++depth;
+	probe.node();
+	direction = order(key, prefix, *current_node, probe);
+        if (direction == 0) { //if the key is already in the tree update the value
 	    current_node->data.second = value;
+	    count_insert(probe);
 	    return;
         }
-        else if (compare(key, current_key)) { // if the new key is smaller go to left subtree
+        else if (direction < 0) { // if the new key is smaller go to left subtree
 	    previous_node = current_node;
             current_node = current_node->left_child.get();
         }
@@ -431,28 +2534,458 @@ void BST<K,V,Comp>::insert(const key_type& key, const value_type& value){
             current_node = current_node->right_child.get();
         }
     }
-    auto& child = (compare(key, previous_node->data.first)) ? previous_node->left_child : previous_node->right_child;
+    auto& child = (direction < 0) ? previous_node->left_child : previous_node->right_child;
     child.reset(new node_type{key, value, previous_node});
+    ++node_count;
+    if (index)
+	index->insert(child.get());
+    add_dense(child.get());
+    count_insert(probe);
+    if (depth > max_depth) { //the tree got taller
+	max_depth = depth;
+	check_height();
+    }
 }
 
 /*
- * insert function (node_type version)
+ * check_height function
  */
-template<class K, class V, class Comp>
-void BST<K,V,Comp>::insert( const node_type& subtree){
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::check_height(){
+
+    if (rebalancing.action == BST_rebalance::mode::off || balancing || rebalance_pending || node_count < rebalancing.min_size)
+	return;
+    if (max_depth <= rebalancing.factor * std::log2(node_count + 1.0))
+	return;
+    ++rebalance_triggers;
+    if (rebalancing.action == BST_rebalance::mode::synchronous) {
+	balance();
+	++rebalance_count;
+    }
+    else {
+	rebalance_pending = true;
+    }
+}
+
+/*
+ * set_rebalance_policy function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::set_rebalance_policy(const BST_rebalance::policy& policy){
+
+    rebalancing = policy;
+    check_height();
+}
+
+/*
+ * maintain function
+ */
+template<class K, class V, class Comp, std::size_t N>
+bool BST<K,V,Comp,N>::maintain(){
+
+    if (!rebalance_pending)
+	return false;
+    balance();
+    ++rebalance_count;
+    return true;
+}
+
+/*
+ * copy function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::copy(const node_type& other_root){
 
-    insert(subtree.data); //copy data in target to the new tree
-    if (subtree.left_child)
-	insert(*subtree.left_child); //copy left subtree
-    if (subtree.right_child)
-	insert(*subtree.right_child); //copy right subtree
+    root.reset(new node_type{other_root.data.first, other_root.data.second, nullptr});
+    const node_type *source{&other_root}; //node currently visited in the copied tree
+    node_type *target{root.get()}; //corresponding node in this tree
+    while (source) {
+
+	if (source->left_child && !target->left_child) { //left subtree not copied yet, go down left
+	    source = source->left_child.get();
+	    target->left_child.reset(new node_type{source->data.first, source->data.second, target});
+	    target = target->left_child.get();
+	}
+	else if (source->right_child && !target->right_child) { //right subtree not copied yet, go down right
+	    source = source->right_child.get();
+	    target->right_child.reset(new node_type{source->data.first, source->data.second, target});
+	    target = target->right_child.get();
+	}
+	else { //both subtrees copied, go back up
+	    source = (source == &other_root) ? nullptr : source->parent;
+	    target = target->parent;
+	}
+    }
+}
+
+/*
+ * clear function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::clear() noexcept {
+
+    if constexpr (N > 0) {
+	if (inline_nodes().active)
+	    free_inline(); //the links do not own the nodes, root is left empty
+	inline_nodes().active = true; //the next pairs go inline again
+    }
+    free_nodes(root);
+    node_count = 0;
+    max_depth = 0;
+    rebalance_pending = false;
+    if (index)
+	index->clear();
+    if (filter)
+	filter->clear();
+    if (dense)
+	dense->clear();
+}
+
+/*
+ * free_nodes function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::free_nodes(std::unique_ptr<node_type>& top) noexcept {
+
+    while (top) {
+
+	if (top->left_child) { //rotate right, so that the left subtree is moved above the top node
+	    std::unique_ptr<node_type> left{std::move(top->left_child)};
+	    top->left_child = std::move(left->right_child);
+	    left->right_child = std::move(top);
+	    top = std::move(left);
+	}
+	else { //no left subtree, free the top node after detaching its right subtree
+	    std::unique_ptr<node_type> right{std::move(top->right_child)};
+	    top = std::move(right);
+	}
+    }
+}
+
+/*
+ * find_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::node_type* BST<K,V,Comp,N>::find_inline(const key_type& key, const std::uint64_t prefix, size_t& position, BST_probe& probe) const {
+
+    position = 0;
+    size_t last{node_count};
+    if constexpr (prefixed) { //count the smaller and the greater prefixes without branching, only keys sharing the prefix are left
+	size_t greater{0};
+	for (size_t i{0}; i < node_count; ++i) {
+	    position += inline_nodes().prefixes[i] < prefix;
+	    greater += inline_nodes().prefixes[i] > prefix;
+	}
+	last -= greater;
+    }
+    while (position < last) { //binary search of the sorted slots
+	const size_t middle{position + ((last - position) >> 1)};
+	const node_type& node{inline_nodes().node(inline_nodes().order[middle])};
+	probe.node();
+	const int direction{order(key, prefix, node, probe)};
+	if (direction == 0)
+	    return const_cast<node_type*>(&node);
+	if (direction < 0)
+	    last = middle;
+	else
+	    position = middle + 1;
+    }
+    return nullptr;
+}
+
+/*
+ * insert_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::insert_inline(const size_t position, const key_type& key, const value_type& value){
+
+    const size_t slot{node_count}; //slots are taken in insertion order
+    node_type* node{::new (inline_nodes().slots[slot]) node_type{key, value, nullptr}};
+    node_type* previous{position > 0 ? &inline_nodes().node(inline_nodes().order[position - 1]) : nullptr};
+    node_type* next{position < node_count ? &inline_nodes().node(inline_nodes().order[position]) : nullptr};
+    std::copy_backward(inline_nodes().order + position, inline_nodes().order + node_count, inline_nodes().order + node_count + 1);
+    inline_nodes().order[position] = static_cast<std::uint8_t>(slot);
+    if constexpr (prefixed) {
+	std::copy_backward(inline_nodes().prefixes + position, inline_nodes().prefixes + node_count, inline_nodes().prefixes + node_count + 1);
+	inline_nodes().prefixes[position] = prefix_of(key);
+    }
+    ++node_count;
+
+    //the new key falls between its neighbours in key order, one of them has room for it below
+    if (previous && !previous->right_child) {
+	node->parent = previous;
+	previous->right_child.reset(node);
+    }
+    else if (next) {
+	node->parent = next;
+	next->left_child.reset(node);
+    }
+    else {
+	root.reset(node);
+    }
+    size_t depth{0};
+    for (const node_type* n{node}; n; n = n->parent)
+	++depth;
+    if (depth > max_depth) {
+	max_depth = depth;
+	check_height();
+    }
+}
+
+/*
+ * link_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::link_inline() noexcept {
+
+    for (size_t i{0}; i < node_count; ++i) { //the nodes are not owned by the links, drop them without freeing
+	inline_nodes().node(i).left_child.release();
+	inline_nodes().node(i).right_child.release();
+    }
+    root.release();
+    root.reset(link_inline(0, node_count, nullptr));
+    max_depth = 0;
+    for (size_t n{node_count}; n > 0; n >>= 1)
+	++max_depth;
+}
+
+/*
+ * link_inline function (subtree version)
+ */
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::node_type* BST<K,V,Comp,N>::link_inline(const size_t lo, const size_t hi, node_type* parent) noexcept {
+
+    if (lo == hi)
+	return nullptr;
+    const size_t mid{lo + ((hi - lo) >> 1)};
+    node_type* node{&inline_nodes().node(inline_nodes().order[mid])};
+    node->parent = parent;
+    node->left_child.reset(link_inline(lo, mid, node));
+    node->right_child.reset(link_inline(mid + 1, hi, node));
+    return node;
+}
+
+/*
+ * copy_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+template<class Tree>
+void BST<K,V,Comp,N>::copy_inline(Tree&& other){
+
+    if constexpr (N > 0) {
+	using value_reference = typename std::conditional<std::is_lvalue_reference<Tree>::value, const value_type&, value_type&&>::type;
+	size_t slot{0};
+	try {
+	    for (; slot < other.node_count; ++slot) {
+		auto& data{other.inline_nodes().node(slot).data};
+		::new (inline_nodes().slots[slot]) node_type{data.first, static_cast<value_reference>(data.second), nullptr};
+	    }
+	}
+	catch (...) { //destroy the nodes built so far, the BST is left empty
+	    while (slot > 0)
+		inline_nodes().node(--slot).~node_type();
+	    node_count = 0;
+	    max_depth = 0;
+	    throw;
+	}
+	auto same = [this, &other](const node_type* n) { //the node in the same slot as n in other
+	    return n ? &inline_nodes().node(other.slot_of(*n)) : nullptr;
+	};
+	for (slot = 0; slot < other.node_count; ++slot) { //link the nodes as in other
+	    const node_type& source{other.inline_nodes().node(slot)};
+	    node_type& target{inline_nodes().node(slot)};
+	    target.parent = same(source.parent);
+	    target.left_child.reset(same(source.left_child.get()));
+	    target.right_child.reset(same(source.right_child.get()));
+	}
+	root.reset(same(other.root.get()));
+	std::copy(other.inline_nodes().order, other.inline_nodes().order + other.node_count, inline_nodes().order);
+	if constexpr (prefixed)
+	    std::copy(other.inline_nodes().prefixes, other.inline_nodes().prefixes + other.node_count, inline_nodes().prefixes);
+	node_count = other.node_count;
+	max_depth = other.max_depth;
+    }
+    else
+	(void)other;
+}
+
+/*
+ * slot_of function
+ */
+template<class K, class V, class Comp, std::size_t N>
+size_t BST<K,V,Comp,N>::slot_of(const node_type& node) const noexcept {
+
+    return static_cast<size_t>(reinterpret_cast<const unsigned char*>(&node) - inline_nodes().slots[0]) / sizeof(node_type);
+}
+
+/*
+ * take_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::take_inline(BST& other) noexcept(nothrow_relocation) {
+
+    if constexpr (N > 0) {
+	copy_inline(std::move(other));
+	other.free_inline();
+	densify(); //the array, if taken from other, points to its nodes
+    }
+    else
+	(void)other;
+}
+
+/*
+ * free_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::free_inline() noexcept {
+
+    for (size_t i{0}; i < node_count; ++i) {
+	inline_nodes().node(i).left_child.release();
+	inline_nodes().node(i).right_child.release();
+    }
+    root.release();
+    for (size_t i{0}; i < node_count; ++i)
+	inline_nodes().node(i).~node_type();
+}
+
+/*
+ * set_inline function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::set_inline(const bool active) noexcept {
+
+    if constexpr (N > 0)
+	inline_nodes().active = active;
+    else
+	(void)active;
+}
+
+/*
+ * grow function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::grow(){
+
+    node_type* top{root.release()};
+    try {
+	copy(*top); //heap copies of the nodes, linked in the same way
+    }
+    catch (...) { //free the copies made so far and keep the inline nodes
+	free_nodes(root);
+	root.reset(top);
+	throw;
+    }
+    std::unique_ptr<node_type> heap_root{std::move(root)};
+    root.reset(top);
+    free_inline();
+    root = std::move(heap_root);
+    set_inline(false);
+    if (index) //the index is filled only now that nodes are on the heap
+	visit(root.get(), nullptr, nullptr, [this](node_type& n) { index->insert(&n); });
+    densify();
+}
+
+/*
+ * layout_veb function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::layout_veb(node_type* node, const size_t levels, std::vector<node_type*>& order) {
+
+    if (!node)
+	return;
+    if (levels == 1) {
+	order.push_back(node);
+	return;
+    }
+    const size_t top{levels / 2};
+    layout_veb(node, top, order);
+    std::vector<std::pair<node_type*, size_t>> stack{{node, 0}}; //collect the roots of the bottom subtrees, left to right
+    std::vector<node_type*> bottoms;
+    while (!stack.empty()) {
+	const auto [current, depth] = stack.back();
+	stack.pop_back();
+	if (depth == top) {
+	    bottoms.push_back(current);
+	    continue;
+	}
+	if (current->right_child)
+	    stack.push_back({current->right_child.get(), depth + 1});
+	if (current->left_child)
+	    stack.push_back({current->left_child.get(), depth + 1});
+    }
+    for (node_type* bottom : bottoms)
+	layout_veb(bottom, levels - top, order);
+}
+
+/*
+ * compact function
+ */
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::compact(const BST_storage::layout order){
+
+    if (!root || is_inline()) //inline nodes are contiguous already
+	return;
+    std::vector<node_type*> nodes; //nodes in their new order
+    nodes.reserve(node_count);
+    if (order == BST_storage::layout::breadth_first) {
+	nodes.push_back(root.get());
+	for (size_t i{0}; i < nodes.size(); ++i) { //the vector is the queue
+	    if (nodes[i]->left_child)
+		nodes.push_back(nodes[i]->left_child.get());
+	    if (nodes[i]->right_child)
+		nodes.push_back(nodes[i]->right_child.get());
+	}
+    }
+    else {
+	layout_veb(root.get(), height(), nodes);
+    }
+
+    using storage = BST_storage::pool<sizeof(node_type), alignof(node_type)>;
+    char* block{storage::allocate_block(nodes.size())};
+    std::vector<node_type*> copies;
+    copies.reserve(nodes.size());
+    try {
+	for (size_t i{0}; i < nodes.size(); ++i) {
+	    const pair_type& data{nodes[i]->data};
+	    copies.push_back(block ? ::new (block + i * storage::stride()) node_type{data.first, data.second, nullptr}
+				   : new node_type{data.first, data.second, nullptr});
+	}
+    }
+    catch (...) { //free the copies and the slots of the block never used, the tree is untouched
+	for (node_type* copy : copies)
+	    delete copy;
+	for (size_t i{copies.size()}; block && i < nodes.size(); ++i)
+	    storage::deallocate(block + i * storage::stride());
+	throw;
+    }
+
+    for (size_t i{0}; i < nodes.size(); ++i) //parents are not needed anymore, map each node to its copy
+	nodes[i]->parent = copies[i];
+    for (size_t i{0}; i < nodes.size(); ++i) {
+	if (node_type* left = nodes[i]->left_child.get()) {
+	    copies[i]->left_child.reset(left->parent);
+	    copies[i]->left_child->parent = copies[i];
+	}
+	if (node_type* right = nodes[i]->right_child.get()) {
+	    copies[i]->right_child.reset(right->parent);
+	    copies[i]->right_child->parent = copies[i];
+	}
+    }
+    std::unique_ptr<node_type> old_root{std::move(root)};
+    root.reset(copies.front()); //the root comes first in both orders
+    free_nodes(old_root);
+    if (index) { //the index and the array point to the old nodes
+	index->clear();
+	visit(root.get(), nullptr, nullptr, [this](node_type& n) { index->insert(&n); });
+    }
+    densify();
 }
 
 /*
  * insert_median function
  */
-template <class K, class V, class Comp>
-void BST<K,V,Comp>::insert_median(std::vector<pair_type>& vect, const size_t lo, const size_t hi){
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::insert_median(std::vector<pair_type>& vect, const size_t lo, const size_t hi){
 
     if (hi-lo == 1){
     
@@ -475,22 +3008,47 @@ void BST<K,V,Comp>::insert_median(std::vector<pair_type>& vect, const size_t lo,
 /*
  * Balance function
  */
-template<class K, class V, class Comp>
-void BST<K,V,Comp>::balance(){
+template<class K, class V, class Comp, std::size_t N>
+void BST<K,V,Comp,N>::balance(){
 
+    BST_LATENCY_TIMER(balance);
+    if constexpr (N > 0) {
+	if (inline_nodes().active) { //relinking the nodes is enough, they do not move
+	    link_inline();
+	    densify();
+	    return;
+	}
+    }
     std::vector<pair_type> pairs;
-    for (const auto& x : *this)
-	pairs.push_back(x);
+    pairs.reserve(node_count);
+    visit_inorder([&pairs](const pair_type& x) { pairs.push_back(x); });
     clear();
+    if (pairs.empty())
+	return;
+    set_inline(pairs.size() <= N); //the pairs would not stay inline, do not start them there
+    if (filter)
+	filter->reset(pairs.size()); //resize the filter for the new number of pairs, insert refills it
+#ifdef BST_PROBE_COUNTERS
+    const probe_stats_type saved{probe_stats()}; //the inserts rebuilding the tree are not counted
+#endif
+    balancing = true; //the inserts rebuilding the tree do not check its height
     insert_median(pairs, 0, pairs.size() - 1);
+    balancing = false;
+#ifdef BST_PROBE_COUNTERS
+    probes.inserts.store(saved.inserts);
+    probes.insert_nodes.store(saved.insert_nodes);
+    probes.insert_comparisons.store(saved.insert_comparisons);
+#endif
+    densify(); //see whether the keys are dense enough for the array
 }
 
 /**
  * Overload of operator[] for BSTs, non-const version
  */
-template<class K, class V, class Comp>
-typename BST<K,V,Comp>::value_type& BST<K,V,Comp>::operator[](const key_type& arg_key) {
+template<class K, class V, class Comp, std::size_t N>
+typename BST<K,V,Comp,N>::value_type& BST<K,V,Comp,N>::operator[](const key_type& arg_key) {
 
+    BST_LATENCY_TIMER(subscript);
     iterator iter = find(arg_key);
     if (iter != end())
 	return (*iter).second;
@@ -501,8 +3059,9 @@ typename BST<K,V,Comp>::value_type& BST<K,V,Comp>::operator[](const key_type& ar
 /**
  * Overload of operator[] for BSTs, const version
  */
-template<class K, class V, class Comp>
-const typename BST<K,V,Comp>::value_type& BST<K,V,Comp>::operator[](const key_type& arg_key) const {
+template<class K, class V, class Comp, std::size_t N>
+const typename BST<K,V,Comp,N>::value_type& BST<K,V,Comp,N>::operator[](const key_type& arg_key) const {
+    BST_LATENCY_TIMER(subscript);
     iterator iter = find(arg_key);
     if (iter != end()) {
         return (*iter).second;
@@ -514,11 +3073,11 @@ const typename BST<K,V,Comp>::value_type& BST<K,V,Comp>::operator[](const key_ty
  * Overload of the operator<< for BSTs, allows to print
  * the key: value pairs of the tree in-order.
  */
-template<class K, class V, class Comp>
-std::ostream& operator<<(std::ostream& os, const BST<K,V,Comp>& tree) {
-    for (const auto& x : tree) {
-        os << x.first << ": " << x.second << std::endl;    //iterate in order and print the key: value pairs
-    }
+template<class K, class V, class Comp, std::size_t N>
+std::ostream& operator<<(std::ostream& os, const BST<K,V,Comp,N>& tree) {
+    tree.visit_inorder([&os](const typename BST<K,V,Comp,N>::pair_type& x) {
+        os << x.first << ": " << x.second << std::endl;    //visit in order and print the key: value pairs
+    });
     return os;
 }
 
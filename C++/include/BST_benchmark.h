@@ -0,0 +1,871 @@
+//: include/BST_benchmark.h
+
+#ifndef __BST_BENCHMARK_H__
+#define __BST_BENCHMARK_H__
+
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <limits>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * Namespace containing the tools used to benchmark BSTs: command line options, timing of
+ * batches of operations, summary statistics and reporting.
+ */
+namespace BST_benchmark {
+
+    /**
+     * Options of a benchmark run, parsed from the command line.
+     */
+    struct Options {
+	//!Number of batches run and discarded before measuring
+	size_t warmup{50};
+	//!Number of measured batches, each giving one sample
+	size_t repetitions{1000};
+	//!Number of operations timed together in a batch
+	size_t batch{100};
+	//!Structures are benchmarked with sizes base^k, for k in [min_exp, max_exp]
+	size_t base{3}, min_exp{1}, max_exp{15};
+	//!Seed of the random generators
+	unsigned long seed{std::random_device{}()};
+	//!Name of the suite to run
+	std::string suite{"lookup"};
+	//!YCSB workloads to run, as a sequence of letters among A to F
+	std::string workload{"ABCDEF"};
+	//!Key distribution of the YCSB workloads, empty to use the one of each workload
+	std::string distribution;
+	//!Size in bytes of the values stored by the YCSB workloads
+	size_t value_size{100};
+	//!Whether hardware performance counters are read around the measured phases
+	bool counters{true};
+	//!Largest number of threads of the multi-threaded benchmark, 0 for the number of hardware threads
+	size_t threads{0};
+	//!Files where the report is written as CSV and as JSON, nothing is written when empty
+	std::string csv, json;
+
+	/**
+	 * Parse options given as --name value pairs, throwing std::invalid_argument on unknown
+	 * options or missing values. --help prints the available options and exits.
+	 * @param argc number of command line arguments
+	 * @param argv command line arguments
+	 * @param defaults values of the options not given on the command line
+	 */
+	static Options parse(const int argc, const char* const argv[], const Options& defaults);
+	static Options parse(const int argc, const char* const argv[]);
+	/**
+	 * Return the sizes to benchmark, that is base^k for k in [min_exp, max_exp].
+	 */
+	std::vector<size_t> sizes() const;
+    };
+
+    /**
+     * Summary statistics of a sample of times per operation, in nanoseconds. Each quantile
+     * comes with a distribution-free 95% confidence interval, given by the order statistics
+     * whose ranks are n q -/+ 1.96 sqrt(n q (1 - q)). When the sample is too small for a
+     * quantile, its interval collapses onto the extreme samples. Samples are batch means, so
+     * p99 and p99.9 are quantiles of batch means, reported as p99_batch and p999_batch: they
+     * describe slow batches, not single slow operations, whose tail the averaging hides.
+     */
+    struct Summary {
+	size_t samples;
+	double mean, min, max;
+	double median, median_lo, median_hi;
+	double p99, p99_lo, p99_hi;
+	double p999, p999_lo, p999_hi;
+    };
+
+    /**
+     * Compute the summary statistics of the given sample.
+     * @param samples times per operation, in nanoseconds
+     */
+    Summary summarize(std::vector<double> samples);
+
+    /**
+     * Hardware events counted during a measured phase, per operation. Events that the machine
+     * or the kernel do not provide are NaN, and nothing is measured when counters are disabled
+     * or unavailable.
+     */
+    struct Counts {
+	//!Number of counted events
+	static constexpr size_t events{6};
+	//!Names of the events, as written in reports
+	static constexpr const char* names[events]{"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses"};
+	//!Whether the counters were read at all
+	bool measured{false};
+	//!Count of each event per operation
+	double values[events]{};
+    };
+
+    /**
+     * Counters class, reads the hardware performance counters of the calling thread through
+     * perf_event_open (Linux only), counting user space events only. Each event is opened on
+     * its own, so that the events the CPU lacks do not prevent counting the others, and counts
+     * are scaled by the fraction of time each event was actually scheduled on the PMU.
+     * A single instance is shared by the whole run, see instance().
+     */
+    class Counters {
+
+	    //!File descriptors of the events, -1 for those that could not be opened
+	    int fds[Counts::events];
+	    //!Whether counting has been enabled by the options
+	    bool enabled;
+	    //!Description of the state of the counters, with the reason why they are unavailable
+	    std::string state;
+
+	    Counters();
+
+	public:
+	    Counters(const Counters&) = delete;
+	    Counters& operator=(const Counters&) = delete;
+	    ~Counters();
+	    /**
+	     * Return the instance shared by all the phases of the run.
+	     */
+	    static Counters& instance();
+	    /**
+	     * Enable or disable counting, start and stop do nothing while disabled.
+	     */
+	    void enable(const bool on) noexcept {enabled = on;}
+	    /**
+	     * Return whether at least one event can be counted.
+	     */
+	    bool available() const noexcept;
+	    /**
+	     * Return a description of the counters, such as the events counted or why none is.
+	     */
+	    const std::string& status() const noexcept {return state;}
+	    /**
+	     * Reset the counters and start counting.
+	     */
+	    void start() noexcept;
+	    /**
+	     * Stop counting and return the counts divided by the given number of operations.
+	     */
+	    Counts stop(const size_t ops) noexcept;
+    };
+
+    /**
+     * One line of a report: a summary for a given suite, structure, workload and size.
+     */
+    struct Record {
+	std::string suite, structure, workload;
+	size_t size;
+	Summary stats;
+	//!Operations per second, when the record measures a throughput rather than latencies
+	double throughput{0};
+	//!Hardware events per operation
+	Counts counts{};
+	//!Unit of the statistics
+	std::string unit{"ns/op"};
+    };
+
+    /**
+     * Report class, collects records and prints them as a table, as CSV or as JSON.
+     */
+    class Report {
+
+	    std::vector<Record> records;
+
+	public:
+	    /**
+	     * Add a record and print it as a table row on the given stream.
+	     */
+	    void add(Record record, std::ostream& os = std::cout);
+	    /**
+	     * Print the header of the table rows printed by add.
+	     */
+	    static void print_header(std::ostream& os = std::cout);
+	    /**
+	     * Write all the records as CSV, one line per record.
+	     */
+	    void write_csv(std::ostream& os) const;
+	    /**
+	     * Write all the records as a JSON array of objects.
+	     */
+	    void write_json(std::ostream& os) const;
+	    /**
+	     * Write the report to the files named in the options, if any.
+	     */
+	    void save(const Options& options) const;
+    };
+
+    //!Number of calls to the global operator new so far, counted by the replacement installed by main.cc
+    inline std::atomic<size_t> heap_allocations{0};
+    //!Bytes currently allocated through the global operator new, as given by malloc_usable_size (glibc only)
+    inline std::atomic<size_t> heap_bytes{0};
+
+    /**
+     * Return the resident set size of the process in bytes, read from /proc/self/statm, or 0
+     * where it is not available.
+     */
+    size_t resident_bytes();
+    /**
+     * Return the bytes of anonymous memory of the process backed by transparent huge pages, read
+     * from /proc/self/smaps_rollup, or 0 where it is not available.
+     */
+    size_t huge_page_bytes();
+    /**
+     * Return the freed memory held by malloc to the operating system where possible, so that
+     * the resident set size grows again with the next allocations.
+     */
+    void release_memory();
+
+    //!Sink for the results of the benchmarked operations, so that the compiler cannot drop them
+    inline volatile size_t sink{0};
+
+    /**
+     * Time batches of calls to op and return the time per operation of each measured batch.
+     * The first options.warmup batches are not measured. op is called with the index of the
+     * operation, counting from 0 across all batches, and must return a value convertible to
+     * size_t, which is accumulated into sink.
+     * @param options the options giving warmup, repetitions and batch size
+     * @param op the operation to benchmark
+     * @param counts if not null, receives the hardware events per operation of the measured batches
+     * @return one time per operation, in nanoseconds, for each measured batch
+     */
+    template <class F>
+    std::vector<double> run_batches(const Options& options, F op, Counts* counts = nullptr);
+
+    /**
+     * Time a single call to op, which is meant for operations that cannot be repeated (such
+     * as tearing down a structure). The time is divided by ops to give a time per operation.
+     * @param ops number of operations performed by op, at least 1
+     * @param op the operation to benchmark
+     * @param counts if not null, receives the hardware events per operation
+     */
+    template <class F>
+    double run_once(const size_t ops, F op, Counts* counts = nullptr);
+
+    /**
+     * Return the overhead of timing a single operation with two reads of the steady clock,
+     * in nanoseconds, as the median of many empty measurements.
+     */
+    double clock_overhead();
+
+    /**
+     * Kinds of operations of the YCSB workloads.
+     */
+    enum class Operation {read, update, insert, scan, read_modify_write};
+    //!Names of the operations, indexed by Operation
+    constexpr const char* operation_names[]{"read", "update", "insert", "scan", "rmw"};
+
+    /**
+     * Mix of operations of a YCSB workload, as proportions summing to 1, along with its
+     * default key distribution. Scans visit between 1 and max_scan records.
+     */
+    struct Mix {
+	std::string name;
+	double read, update, insert, scan, read_modify_write;
+	std::string distribution;
+	size_t max_scan{100};
+
+	/**
+	 * Return the core YCSB workload with the given letter: A (50% reads, 50% updates),
+	 * B (95% reads, 5% updates), C (only reads), D (95% reads, 5% inserts, latest keys),
+	 * E (95% short scans, 5% inserts), F (50% reads, 50% read-modify-writes). Throws
+	 * std::invalid_argument on other letters.
+	 */
+	static Mix core(const char letter);
+    };
+
+    /**
+     * One operation of a generated workload.
+     */
+    struct Request {
+	Operation operation;
+	//! index of the record the operation starts at
+	size_t record;
+	//! number of records visited by a scan
+	size_t length;
+    };
+
+    /**
+     * Return the key of the record with the given index. Keys are scrambled with the FNV-1a hash,
+     * as in YCSB, so that the order of insertion is unrelated to the order of keys.
+     */
+    inline size_t record_key(const size_t record) noexcept {
+	size_t hash{14695981039346656037ULL};
+	for (size_t i{0}; i < 8; ++i)
+	    hash = (hash ^ ((record >> (8 * i)) & 0xff)) * 1099511628211ULL;
+	return hash;
+    }
+
+    /**
+     * Zipfian generator of ranks in [0, n), where rank 0 is the most popular, following Gray et
+     * al. "Quickly generating billion-record synthetic databases", as done in YCSB (theta = 0.99).
+     * The zeta constant is updated incrementally when n grows.
+     */
+    class Zipfian {
+
+	    double theta, zeta2, zetan, alpha, eta;
+	    size_t items;
+
+	    void update_eta() {
+		eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+	    }
+
+	public:
+	    explicit Zipfian(const size_t n, const double skew = 0.99)
+	     : theta{skew}, zeta2{1 + std::pow(0.5, skew)}, zetan{0}, alpha{1 / (1 - skew)}, eta{0}, items{0}
+	    {
+		resize(n);
+	    }
+	    /**
+	     * Extend the range of the generated ranks to [0, n), n can only grow
+	     */
+	    void resize(const size_t n) {
+		for (; items < n; ++items)
+		    zetan += 1 / std::pow(static_cast<double>(items + 1), theta);
+		update_eta();
+	    }
+	    template <class G>
+	    size_t operator()(G& generator) {
+		const double u{std::uniform_real_distribution<double>{0, 1}(generator)};
+		const double uz{u * zetan};
+		if (uz < 1)
+		    return 0;
+		if (uz < zeta2)
+		    return 1;
+		return std::min(items - 1, static_cast<size_t>(items * std::pow(eta * u - eta + 1, alpha)));
+	    }
+    };
+
+    /**
+     * Generate the requests of a YCSB workload run against a store already holding the given
+     * number of records. Inserts add records at the end, so that the latest distribution (a
+     * Zipfian over recency) favours them.
+     * @param mix the workload
+     * @param distribution key distribution: uniform, zipfian (scrambled), latest or sequential
+     * @param records number of records loaded before the run
+     * @param count number of requests to generate
+     * @param seed seed of the random generator
+     */
+    std::vector<Request> generate(const Mix& mix, const std::string& distribution, const size_t records,
+				  const size_t count, const unsigned long seed);
+}
+
+
+/*
+ * Options::parse function
+ */
+inline BST_benchmark::Options BST_benchmark::Options::parse(const int argc, const char* const argv[], const Options& defaults) {
+
+    Options options{defaults};
+    for (int i{1}; i < argc; ++i) {
+
+	const std::string name{argv[i]};
+	if (name == "--help") {
+	    std::cout << "Options (defaults in brackets):\n"
+		      << "  --suite NAME        suite to run: lookup, ycsb, memory, orders, types, pages, small, dense, or scaling for bst_mt_benchmark [" << defaults.suite << "]\n"
+		      << "  --warmup N          batches discarded before measuring [" << defaults.warmup << "]\n"
+		      << "  --repetitions N     measured batches [" << defaults.repetitions << "]\n"
+		      << "  --batch N           operations per batch [" << defaults.batch << "]\n"
+		      << "  --base N            sizes are base^k [" << defaults.base << "]\n"
+		      << "  --min-exp K         smallest k [" << defaults.min_exp << "]\n"
+		      << "  --max-exp K         largest k [" << defaults.max_exp << "]\n"
+		      << "  --seed N            seed of the random generators [random]\n"
+		      << "  --workload LETTERS  YCSB workloads to run [" << defaults.workload << "]\n"
+		      << "  --distribution NAME YCSB key distribution: uniform, zipfian, latest, sequential [per workload]\n"
+		      << "  --value-size N      bytes per YCSB value [" << defaults.value_size << "]\n"
+		      << "  --counters on|off   read hardware performance counters [on]\n"
+		      << "  --threads N         largest number of threads of bst_mt_benchmark [hardware threads]\n"
+		      << "  --csv FILE          write the report as CSV\n"
+		      << "  --json FILE         write the report as JSON" << std::endl;
+	    std::exit(0);
+	}
+	if (i + 1 == argc)
+	    throw std::invalid_argument{"missing value for option " + name};
+	const std::string value{argv[++i]};
+	if (name == "--suite") options.suite = value;
+	else if (name == "--csv") options.csv = value;
+	else if (name == "--json") options.json = value;
+	else if (name == "--warmup") options.warmup = std::stoul(value);
+	else if (name == "--repetitions") options.repetitions = std::max(1ul, std::stoul(value));
+	else if (name == "--batch") options.batch = std::max(1ul, std::stoul(value));
+	else if (name == "--base") options.base = std::max(2ul, std::stoul(value));
+	else if (name == "--min-exp") options.min_exp = std::stoul(value);
+	else if (name == "--max-exp") options.max_exp = std::stoul(value);
+	else if (name == "--seed") options.seed = std::stoul(value);
+	else if (name == "--workload") options.workload = value;
+	else if (name == "--distribution") options.distribution = value;
+	else if (name == "--value-size") options.value_size = std::stoul(value);
+	else if (name == "--counters" && (value == "on" || value == "off")) options.counters = value == "on";
+	else if (name == "--threads") options.threads = std::stoul(value);
+	else throw std::invalid_argument{"unknown option " + name};
+    }
+    for (const char letter : options.workload)
+	Mix::core(letter); //throws on unknown workloads
+    if (!options.distribution.empty() && options.distribution != "uniform" && options.distribution != "zipfian"
+	&& options.distribution != "latest" && options.distribution != "sequential")
+	throw std::invalid_argument{"unknown key distribution " + options.distribution};
+    return options;
+}
+
+inline BST_benchmark::Options BST_benchmark::Options::parse(const int argc, const char* const argv[]) {
+
+    return parse(argc, argv, Options{});
+}
+
+/*
+ * Options::sizes function
+ */
+inline std::vector<size_t> BST_benchmark::Options::sizes() const {
+
+    std::vector<size_t> result;
+    size_t size{1};
+    for (size_t k{0}; k <= max_exp; ++k) {
+	if (k >= min_exp)
+	    result.push_back(size);
+	size *= base;
+    }
+    return result;
+}
+
+/*
+ * summarize function
+ */
+inline BST_benchmark::Summary BST_benchmark::summarize(std::vector<double> samples) {
+
+    Summary s{};
+    s.samples = samples.size();
+    if (samples.empty())
+	return s;
+    std::sort(samples.begin(), samples.end());
+    const double n{static_cast<double>(samples.size())};
+    auto at = [&samples](const double rank) { //sample with the given 0-based rank, clamped
+	const double clamped{std::min(std::max(rank, 0.0), static_cast<double>(samples.size() - 1))};
+	return samples[static_cast<size_t>(clamped)];
+    };
+    auto quantile = [&](const double q, double& value, double& lo, double& hi) {
+	const double spread{1.96 * std::sqrt(n * q * (1 - q))};
+	value = at(std::ceil(n * q) - 1);
+	lo = at(std::floor(n * q - spread) - 1);
+	hi = at(std::ceil(n * q + spread) - 1);
+    };
+
+    double total{0};
+    for (auto x : samples)
+	total += x;
+    s.mean = total / n;
+    s.min = samples.front();
+    s.max = samples.back();
+    quantile(0.5, s.median, s.median_lo, s.median_hi);
+    quantile(0.99, s.p99, s.p99_lo, s.p99_hi);
+    quantile(0.999, s.p999, s.p999_lo, s.p999_hi);
+    return s;
+}
+
+/*
+ * Counters constructor
+ */
+inline BST_benchmark::Counters::Counters() : fds{}, enabled{true}, state{} {
+
+    std::fill(std::begin(fds), std::end(fds), -1);
+#ifdef __linux__
+    auto cache = [](const unsigned long long cache, const unsigned long long op, const unsigned long long result) {
+	return cache | (op << 8) | (result << 16);
+    };
+    const std::pair<unsigned, unsigned long long> events[Counts::events]{
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    };
+    std::string opened, error;
+    for (size_t e{0}; e < Counts::events; ++e) {
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[e].first;
+	attr.config = events[e].second;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)); //this thread, any CPU
+	if (fds[e] >= 0)
+	    opened += (opened.empty() ? "" : ", ") + std::string{Counts::names[e]};
+	else if (error.empty())
+	    error = std::strerror(errno);
+    }
+    state = opened.empty() ? "unavailable (" + error + ")" : opened;
+#else
+    state = "unavailable (not Linux)";
+#endif
+}
+
+/*
+ * Counters destructor
+ */
+inline BST_benchmark::Counters::~Counters() {
+
+#ifdef __linux__
+    for (const int fd : fds)
+	if (fd >= 0)
+	    close(fd);
+#endif
+}
+
+/*
+ * Counters::instance function
+ */
+inline BST_benchmark::Counters& BST_benchmark::Counters::instance() {
+
+    static Counters counters{};
+    return counters;
+}
+
+/*
+ * Counters::available function
+ */
+inline bool BST_benchmark::Counters::available() const noexcept {
+
+    return std::any_of(std::begin(fds), std::end(fds), [](const int fd) { return fd >= 0; });
+}
+
+/*
+ * Counters::start function
+ */
+inline void BST_benchmark::Counters::start() noexcept {
+
+#ifdef __linux__
+    if (!enabled)
+	return;
+    for (const int fd : fds)
+	if (fd >= 0) {
+	    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+/*
+ * Counters::stop function
+ */
+inline BST_benchmark::Counts BST_benchmark::Counters::stop(const size_t ops) noexcept {
+
+    Counts counts{};
+#ifdef __linux__
+    if (!enabled || !available())
+	return counts;
+    for (const int fd : fds)
+	if (fd >= 0)
+	    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    counts.measured = true;
+    for (size_t e{0}; e < Counts::events; ++e) {
+	unsigned long long data[3]{}; //value, time enabled, time running
+	counts.values[e] = std::numeric_limits<double>::quiet_NaN();
+	if (fds[e] >= 0 && read(fds[e], data, sizeof(data)) == sizeof(data) && data[2] > 0) //scale multiplexed events
+	    counts.values[e] = static_cast<double>(data[0]) * data[1] / data[2] / std::max(ops, size_t{1});
+    }
+#else
+    (void)ops;
+#endif
+    return counts;
+}
+
+/*
+ * Report::print_header function
+ */
+inline void BST_benchmark::Report::print_header(std::ostream& os) {
+
+    os << std::left << std::setw(10) << "suite" << std::setw(22) << "structure" << std::setw(14) << "workload"
+       << std::right << std::setw(10) << "size" << std::setw(12) << "median" << std::setw(24) << "95% CI"
+       << std::setw(12) << "p99 batch" << std::setw(12) << "p99.9 batch" << "  (ns/op unless stated, ops/s)" << std::endl;
+}
+
+/*
+ * Report::add function
+ */
+inline void BST_benchmark::Report::add(Record record, std::ostream& os) {
+
+    const Summary& s{record.stats};
+    std::ostringstream ci;
+    ci << std::fixed << std::setprecision(1) << "[" << s.median_lo << ", " << s.median_hi << "]";
+    os << std::left << std::setw(10) << record.suite << std::setw(22) << record.structure << std::setw(14) << record.workload
+       << std::right << std::setw(10) << record.size << std::fixed << std::setprecision(1) << std::setw(12) << s.median
+       << std::setw(24) << ci.str() << std::setw(12) << s.p99 << std::setw(12) << s.p999;
+    if (record.throughput > 0)
+	os << std::setprecision(0) << "  " << record.throughput;
+    if (record.unit != "ns/op")
+	os << "  " << record.unit;
+    os << std::endl;
+    if (record.counts.measured) { //events per operation on a second line
+	os << std::setw(40) << "per op:" << std::setprecision(2);
+	for (size_t e{0}; e < Counts::events; ++e) {
+	    os << "  " << Counts::names[e] << ' ';
+	    if (std::isnan(record.counts.values[e]))
+		os << "n/a";
+	    else
+		os << record.counts.values[e];
+	}
+	os << std::endl;
+    }
+    records.push_back(std::move(record));
+}
+
+/*
+ * Report::write_csv function
+ */
+inline void BST_benchmark::Report::write_csv(std::ostream& os) const {
+
+    os << "suite,structure,workload,size,samples,mean,min,max,median,median_lo,median_hi,p99_batch,p99_batch_lo,p99_batch_hi,p999_batch,p999_batch_lo,p999_batch_hi,throughput";
+    for (const char* name : Counts::names)
+	os << ',' << name;
+    os << ",unit\n";
+    for (const auto& r : records) {
+	const Summary& s{r.stats};
+	os << r.suite << ',' << r.structure << ',' << r.workload << ',' << r.size << ',' << s.samples << ','
+	   << s.mean << ',' << s.min << ',' << s.max << ',' << s.median << ',' << s.median_lo << ',' << s.median_hi << ','
+	   << s.p99 << ',' << s.p99_lo << ',' << s.p99_hi << ',' << s.p999 << ',' << s.p999_lo << ',' << s.p999_hi << ',' << r.throughput;
+	for (const double x : r.counts.values) { //empty when not measured
+	    os << ',';
+	    if (r.counts.measured && !std::isnan(x))
+		os << x;
+	}
+	os << ',' << r.unit << '\n';
+    }
+}
+
+/*
+ * Report::write_json function
+ */
+inline void BST_benchmark::Report::write_json(std::ostream& os) const {
+
+    os << "[\n";
+    for (size_t i{0}; i < records.size(); ++i) {
+	const Record& r{records[i]};
+	const Summary& s{r.stats};
+	os << "  {\"suite\": \"" << r.suite << "\", \"structure\": \"" << r.structure << "\", \"workload\": \"" << r.workload
+	   << "\", \"size\": " << r.size << ", \"samples\": " << s.samples << ", \"mean\": " << s.mean
+	   << ", \"min\": " << s.min << ", \"max\": " << s.max
+	   << ", \"median\": " << s.median << ", \"median_ci\": [" << s.median_lo << ", " << s.median_hi << "]"
+	   << ", \"p99_batch\": " << s.p99 << ", \"p99_batch_ci\": [" << s.p99_lo << ", " << s.p99_hi << "]"
+	   << ", \"p999_batch\": " << s.p999 << ", \"p999_batch_ci\": [" << s.p999_lo << ", " << s.p999_hi << "]"
+	   << ", \"unit\": \"" << r.unit << "\", \"throughput\": " << r.throughput << ", \"counters\": ";
+	if (r.counts.measured) { //null for the events not measured
+	    os << '{';
+	    for (size_t e{0}; e < Counts::events; ++e) {
+		os << (e ? ", \"" : "\"") << Counts::names[e] << "\": ";
+		if (std::isnan(r.counts.values[e]))
+		    os << "null";
+		else
+		    os << r.counts.values[e];
+	    }
+	    os << '}';
+	}
+	else
+	    os << "null";
+	os << '}' << (i + 1 < records.size() ? ",\n" : "\n");
+    }
+    os << "]\n";
+}
+
+/*
+ * Report::save function
+ */
+inline void BST_benchmark::Report::save(const Options& options) const {
+
+    if (!options.csv.empty()) {
+	std::ofstream file{options.csv};
+	write_csv(file);
+    }
+    if (!options.json.empty()) {
+	std::ofstream file{options.json};
+	write_json(file);
+    }
+}
+
+/*
+ * clock_overhead function
+ */
+inline double BST_benchmark::clock_overhead() {
+
+    std::vector<double> samples;
+    for (size_t i{0}; i < 1001; ++i) {
+	const auto start = std::chrono::steady_clock::now();
+	const auto end = std::chrono::steady_clock::now();
+	samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    std::nth_element(samples.begin(), samples.begin() + 500, samples.end());
+    return samples[500];
+}
+
+/*
+ * Mix::core function
+ */
+inline BST_benchmark::Mix BST_benchmark::Mix::core(const char letter) {
+
+    switch (letter) {
+	case 'A': return Mix{"A", 0.5, 0.5, 0, 0, 0, "zipfian"};
+	case 'B': return Mix{"B", 0.95, 0.05, 0, 0, 0, "zipfian"};
+	case 'C': return Mix{"C", 1, 0, 0, 0, 0, "zipfian"};
+	case 'D': return Mix{"D", 0.95, 0, 0.05, 0, 0, "latest"};
+	case 'E': return Mix{"E", 0, 0, 0.05, 0.95, 0, "zipfian"};
+	case 'F': return Mix{"F", 0.5, 0, 0, 0, 0.5, "zipfian"};
+	default: throw std::invalid_argument{std::string{"unknown YCSB workload "} + letter};
+    }
+}
+
+/*
+ * generate function
+ */
+inline std::vector<BST_benchmark::Request> BST_benchmark::generate(const Mix& mix, const std::string& distribution,
+								     const size_t records, const size_t count, const unsigned long seed) {
+
+    if (distribution != "uniform" && distribution != "zipfian" && distribution != "latest" && distribution != "sequential")
+	throw std::invalid_argument{"unknown key distribution " + distribution};
+    std::mt19937_64 generator{seed};
+    std::uniform_real_distribution<double> coin{0, 1};
+    std::uniform_int_distribution<size_t> scan_length{1, mix.max_scan};
+    Zipfian zipfian{std::max(records, size_t{1})};
+    size_t items{std::max(records, size_t{1})}, next{0};
+
+    auto choose = [&]() -> size_t { //index of an existing record
+	if (distribution == "uniform")
+	    return std::uniform_int_distribution<size_t>{0, items - 1}(generator);
+	if (distribution == "sequential")
+	    return next++ % items;
+	zipfian.resize(items);
+	const size_t rank{zipfian(generator)};
+	if (distribution == "latest")
+	    return items - 1 - rank;
+	return record_key(rank) % items; //scrambled, so that popular records are spread over the key space
+    };
+
+    std::vector<Request> requests;
+    requests.reserve(count);
+    for (size_t i{0}; i < count; ++i) {
+	double dice{coin(generator)};
+	if ((dice -= mix.insert) < 0) {
+	    requests.push_back({Operation::insert, items++, 0});
+	}
+	else if ((dice -= mix.scan) < 0) {
+	    const size_t start{choose()};
+	    requests.push_back({Operation::scan, start, scan_length(generator)});
+	}
+	else if ((dice -= mix.update) < 0) {
+	    requests.push_back({Operation::update, choose(), 0});
+	}
+	else if ((dice -= mix.read_modify_write) < 0) {
+	    requests.push_back({Operation::read_modify_write, choose(), 0});
+	}
+	else {
+	    requests.push_back({Operation::read, choose(), 0});
+	}
+    }
+    return requests;
+}
+
+/*
+ * resident_bytes function
+ */
+inline size_t BST_benchmark::resident_bytes() {
+
+#ifdef __linux__
+    std::ifstream statm{"/proc/self/statm"};
+    size_t total{0}, resident{0};
+    if (statm >> total >> resident)
+	return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+/*
+ * huge_page_bytes function
+ */
+inline size_t BST_benchmark::huge_page_bytes() {
+
+#ifdef __linux__
+    std::ifstream smaps{"/proc/self/smaps_rollup"};
+    std::string field;
+    size_t kilobytes{0};
+    while (smaps >> field) {
+	if (field == "AnonHugePages:" && smaps >> kilobytes)
+	    return kilobytes * 1024;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * release_memory function
+ */
+inline void BST_benchmark::release_memory() {
+
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+/*
+ * run_batches function
+ */
+template <class F>
+std::vector<double> BST_benchmark::run_batches(const Options& options, F op, Counts* counts) {
+
+    std::vector<double> samples;
+    samples.reserve(options.repetitions);
+    size_t i{0}, accumulator{0};
+    for (size_t b{0}; b < options.warmup; ++b)
+	for (size_t j{0}; j < options.batch; ++j)
+	    accumulator += static_cast<size_t>(op(i++));
+
+    if (counts)
+	Counters::instance().start();
+    for (size_t b{0}; b < options.repetitions; ++b) { //the clock is read twice per batch, not per operation
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t j{0}; j < options.batch; ++j)
+	    accumulator += static_cast<size_t>(op(i++));
+	const auto end = std::chrono::steady_clock::now();
+	samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / options.batch);
+    }
+    if (counts)
+	*counts = Counters::instance().stop(options.repetitions * options.batch);
+    sink = sink + accumulator;
+    return samples;
+}
+
+/*
+ * run_once function
+ */
+template <class F>
+double BST_benchmark::run_once(const size_t ops, F op, Counts* counts) {
+
+    if (counts)
+	Counters::instance().start();
+    const auto start = std::chrono::steady_clock::now();
+    op();
+    const auto end = std::chrono::steady_clock::now();
+    if (counts)
+	*counts = Counters::instance().stop(ops);
+    return std::chrono::duration<double, std::nano>(end - start).count() / std::max(ops, size_t{1});
+}
+
+
+#endif
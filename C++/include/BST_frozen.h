@@ -0,0 +1,250 @@
+//: include/BST_frozen.h
+
+#ifndef __BST_FROZEN_H__
+#define __BST_FROZEN_H__
+
+
+#include "BST.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+
+/**
+ * BST_frozen class, an immutable snapshot of a BST<std::string, V> taking far less memory
+ * than the tree when keys share long prefixes (e.g. URLs).
+ * Keys are stored in-order and front-coded in blocks of block_size keys: each key is stored
+ * as the length of the prefix it shares with the previous key, followed by the rest of it,
+ * except for the first key of each block, which is stored in full. The offsets of the blocks
+ * form a small sampled index: find binary searches the first keys of the blocks and then
+ * decodes a single block. Values are stored in-order in a separate vector.
+ * Since prefixes are shared in lexicographic order, only trees using std::less are supported.
+ */
+template <class V>
+class BST_frozen {
+
+    public:
+	//!Alias for the type of keys
+	using key_type = std::string;
+	//!Alias for the type of values
+	using value_type = V;
+	//!Number of keys in each block, the first one being stored in full
+	static constexpr size_t block_size{16};
+
+	class const_iterator;
+
+    private:
+
+	//!Front-coded keys, one block after the other
+	std::vector<char> bytes;
+	//!Offset in bytes of the first key of each block
+	std::vector<size_t> blocks;
+	//!Values, values[i] being associated to the i-th key
+	std::vector<value_type> values;
+
+	/**
+	 * Utility function appending n to bytes as a LEB128 variable length integer.
+	 */
+	void put_length(size_t n);
+	/**
+	 * Utility function reading a LEB128 variable length integer at pos, and moving pos past it.
+	 */
+	size_t get_length(size_t& pos) const noexcept;
+	/**
+	 * Utility function returning the first key of the given block, without copying it.
+	 */
+	std::string_view head(const size_t block) const noexcept;
+
+    public:
+
+	/**
+	 * Create a snapshot of the given tree.
+	 * @param tree BST to take the snapshot of
+	 */
+	explicit BST_frozen(const BST<key_type, value_type>& tree);
+	/**
+	 * Return the number of key-value pairs.
+	 */
+	size_t size() const noexcept {return values.size();}
+	/**
+	 * Return the number of bytes used by the snapshot, not counting memory owned by the values.
+	 */
+	size_t memory() const noexcept {
+
+	    return sizeof(*this) + bytes.capacity() + blocks.capacity() * sizeof(size_t) + values.capacity() * sizeof(value_type);
+	}
+	/**
+	 * begin returns an iterator to the smallest key, end an iterator past the greatest one.
+	 */
+	const_iterator begin() const {return const_iterator{this, 0, 0};}
+	const_iterator end() const {return const_iterator{this, size(), bytes.size()};}
+	/**
+	 * Return an iterator to the pair having the given key, end() if it is not found.
+	 * @param key the sought-after key
+	 */
+	const_iterator find(const key_type& key) const;
+};
+
+/*
+ * Iterator class, decodes the keys one after the other, so that the key of the current pair
+ * is kept in a buffer owned by the iterator.
+ */
+template <class V>
+class BST_frozen<V>::const_iterator {
+
+        friend BST_frozen;
+        //! snapshot being traversed
+        const BST_frozen* frozen;
+        //! index of the current pair
+        size_t index;
+        //! offset in bytes of the key following the current one
+        size_t next;
+        //! the current key, decoded
+        std::string key;
+
+        /**
+         * Constructor, decodes the key at the given offset if index is not past the end
+         */
+        const_iterator(const BST_frozen* f, const size_t i, const size_t pos) : frozen{f}, index{i}, next{pos}, key{} {
+            if (index < frozen->size())
+                decode();
+        }
+        /**
+         * Decode the key at offset next on top of the current one, and move next past it.
+         */
+        void decode() {
+            const size_t shared{frozen->get_length(next)};
+            const size_t rest{frozen->get_length(next)};
+            key.resize(shared);
+            key.append(frozen->bytes.data() + next, rest);
+            next += rest;
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const std::string&, const V&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        /**
+         * dereferencing operator, returns a pair of references to the current key and value.
+         * The key reference is invalidated when the iterator moves.
+         */
+        value_type operator*() const {return value_type{key, frozen->values[index]};}
+        /**
+         * pre-increment operator
+         */
+        const_iterator& operator++() {
+            if (++index < frozen->size())
+                decode();
+            return *this;
+        }
+        /**
+         * Comparison operators
+         */
+        bool operator==(const const_iterator& other) const {return index == other.index;}
+        bool operator!=(const const_iterator& other) const {return !(*this == other);}
+};
+
+/*
+ * Constructor
+ */
+template <class V>
+BST_frozen<V>::BST_frozen(const BST<key_type, value_type>& tree) : bytes{}, blocks{}, values{} {
+
+    values.reserve(tree.size());
+    blocks.reserve(tree.size() / block_size + 1);
+    const std::string* previous{nullptr};
+    tree.visit_inorder([&](const typename BST<key_type, value_type>::pair_type& x) {
+	size_t shared{0};
+	if (values.size() % block_size == 0) { //first key of a block, stored in full
+	    blocks.push_back(bytes.size());
+	}
+	else { //store only what differs from the previous key
+	    const size_t limit{std::min(previous->size(), x.first.size())};
+	    while (shared < limit && (*previous)[shared] == x.first[shared])
+		++shared;
+	}
+	put_length(shared);
+	put_length(x.first.size() - shared);
+	bytes.insert(bytes.end(), x.first.begin() + shared, x.first.end());
+	values.push_back(x.second);
+	previous = &x.first;
+    });
+    bytes.shrink_to_fit();
+}
+
+/*
+ * put_length function
+ */
+template <class V>
+void BST_frozen<V>::put_length(size_t n) {
+
+    while (n >= 0x80) { //seven bits at a time, the high bit tells whether more follow
+	bytes.push_back(static_cast<char>((n & 0x7f) | 0x80));
+	n >>= 7;
+    }
+    bytes.push_back(static_cast<char>(n));
+}
+
+/*
+ * get_length function
+ */
+template <class V>
+size_t BST_frozen<V>::get_length(size_t& pos) const noexcept {
+
+    size_t n{0};
+    for (unsigned shift{0}; ; shift += 7) {
+	const unsigned char byte{static_cast<unsigned char>(bytes[pos++])};
+	n |= static_cast<size_t>(byte & 0x7f) << shift;
+	if (!(byte & 0x80))
+	    return n;
+    }
+}
+
+/*
+ * head function
+ */
+template <class V>
+std::string_view BST_frozen<V>::head(const size_t block) const noexcept {
+
+    size_t pos{blocks[block]};
+    get_length(pos); //the shared length is zero
+    const size_t length{get_length(pos)};
+    return std::string_view{bytes.data() + pos, length};
+}
+
+/*
+ * find function
+ */
+template <class V>
+typename BST_frozen<V>::const_iterator BST_frozen<V>::find(const key_type& key) const {
+
+    if (blocks.empty() || std::string_view{key} < head(0))
+	return end();
+    size_t lo{0}, hi{blocks.size()}; //look for the last block whose first key is not greater than key
+    while (hi - lo > 1) {
+	const size_t mid{lo + ((hi - lo) >> 1)};
+	if (std::string_view{key} < head(mid))
+	    hi = mid;
+	else
+	    lo = mid;
+    }
+
+    const size_t stop{std::min(size(), (lo + 1) * block_size)};
+    for (const_iterator it{this, lo * block_size, blocks[lo]}; it.index < stop; ++it) { //decode the block
+	const int order{it.key.compare(key)};
+	if (order == 0)
+	    return it;
+	if (order > 0)
+	    break;
+    }
+    return end();
+}
+
+
+#endif
@@ -0,0 +1,396 @@
+//: include/BST_latency.h
+
+#ifndef __BST_LATENCY_H__
+#define __BST_LATENCY_H__
+
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <algorithm>
+
+
+/**
+ * Namespace containing the latency histograms of BST operations, compiled in only when
+ * BST_LATENCY_HISTOGRAMS is defined (consistently in every translation unit). Each thread
+ * records the latencies of its find, insert, operator[] and balance calls, on any tree, into
+ * its own histograms, without locks or atomic read-modify-writes; snapshot merges the
+ * histograms of all the threads, including the ones that have exited.
+ */
+namespace BST_latency {
+
+    //! The timed operations
+    enum class operation {find, insert, subscript, balance};
+    //! Number of timed operations
+    constexpr size_t operations{4};
+    //! Names of the operations, indexed by operation
+    constexpr const char* operation_names[operations]{"find", "insert", "operator[]", "balance"};
+
+    /**
+     * Log-linear bucketing of latencies in nanoseconds, in the style of HdrHistogram: values
+     * below 2^precision have a bucket each, and every larger power of two range is split into
+     * 2^precision buckets, so that the relative error is below 2^-precision (about 3%).
+     */
+    struct buckets {
+	//! Number of significant bits kept
+	static constexpr unsigned precision{5};
+	//! Number of buckets covering all 64 bits values
+	static constexpr size_t count{(64 - precision + 1) << precision};
+
+	/**
+	 * Return the bucket of the given value.
+	 */
+	static size_t index(const std::uint64_t value) noexcept {
+	    if (value < (std::uint64_t{1} << precision))
+		return static_cast<size_t>(value);
+	    const unsigned magnitude{63u - static_cast<unsigned>(__builtin_clzll(value))};
+	    const unsigned shift{magnitude - precision};
+	    return ((shift + 1) << precision) + static_cast<size_t>((value >> shift) - (std::uint64_t{1} << precision));
+	}
+	/**
+	 * Return the smallest value falling in the given bucket.
+	 */
+	static std::uint64_t lowest(const size_t bucket) noexcept {
+	    if (bucket < (size_t{1} << precision))
+		return bucket;
+	    const unsigned shift{static_cast<unsigned>(bucket >> precision) - 1};
+	    return ((std::uint64_t{1} << precision) + (bucket & ((size_t{1} << precision) - 1))) << shift;
+	}
+    };
+
+    /**
+     * Histogram class, a mergeable snapshot of the latencies of one operation, in nanoseconds.
+     */
+    class histogram {
+
+	    std::vector<std::uint64_t> counts;
+	    std::uint64_t total, sum, smallest, largest;
+
+	public:
+	    histogram() : counts(buckets::count), total{0}, sum{0}, smallest{~std::uint64_t{0}}, largest{0} {}
+	    /**
+	     * Add a latency.
+	     */
+	    void record(const std::uint64_t ns) noexcept;
+	    /**
+	     * Add count latencies falling in the given bucket, whose sum is given.
+	     */
+	    void add(const size_t bucket, const std::uint64_t count, const std::uint64_t bucket_sum) noexcept;
+	    /**
+	     * Add all the latencies of other.
+	     */
+	    void merge(const histogram& other) noexcept;
+	    /**
+	     * Return the number of latencies recorded.
+	     */
+	    std::uint64_t count() const noexcept {return total;}
+	    /**
+	     * Return the smallest, the largest and the mean latency, 0 if none was recorded.
+	     */
+	    std::uint64_t min() const noexcept {return total ? smallest : 0;}
+	    std::uint64_t max() const noexcept {return largest;}
+	    double mean() const noexcept {return total ? static_cast<double>(sum) / total : 0;}
+	    /**
+	     * Return the q-quantile of the latencies, as the lowest value of its bucket (clamped to
+	     * the recorded extremes), 0 if none was recorded.
+	     * @param q the quantile, in [0, 1]
+	     */
+	    std::uint64_t quantile(const double q) const noexcept;
+	    /**
+	     * Call f(lowest, count) on each non-empty bucket, in increasing order of latency.
+	     */
+	    template <class F>
+	    void for_each_bucket(F f) const {
+		for (size_t b{0}; b < counts.size(); ++b)
+		    if (counts[b])
+			f(buckets::lowest(b), counts[b]);
+	    }
+    };
+
+    //! Histograms of all the operations, indexed by operation
+    using snapshot_type = std::array<histogram, operations>;
+
+    /**
+     * Return the histograms of all the threads merged together, including the threads that have
+     * exited. Counts being updated while the snapshot is taken may or may not be included.
+     */
+    snapshot_type snapshot();
+    /**
+     * Discard all the latencies recorded so far. Latencies being recorded concurrently may be lost.
+     */
+    void reset();
+    /**
+     * Write a snapshot as a JSON object mapping each operation to its count, mean, min, max,
+     * p50, p90, p99, p99.9 and to its non-empty buckets, given as [lowest value, count] pairs.
+     */
+    void write_json(std::ostream& os, const snapshot_type& histograms);
+
+    /**
+     * Recorder class, histograms of the calling thread. Counts are written by their thread
+     * only, with relaxed atomic stores so that snapshots can read them concurrently; a
+     * recorder registers itself on creation and is merged into the retired histograms when its
+     * thread exits.
+     */
+    class recorder {
+
+	    std::array<std::array<std::atomic<std::uint64_t>, buckets::count>, operations> counts;
+	    std::array<std::array<std::atomic<std::uint64_t>, buckets::count>, operations> sums;
+
+	public:
+	    recorder();
+	    ~recorder();
+	    recorder(const recorder&) = delete;
+	    recorder& operator=(const recorder&) = delete;
+	    /**
+	     * Add a latency of the given operation, from the owning thread only.
+	     */
+	    void record(const operation op, const std::uint64_t ns) noexcept {
+		const size_t b{buckets::index(ns)};
+		auto& count = counts[static_cast<size_t>(op)][b];
+		auto& sum = sums[static_cast<size_t>(op)][b];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	    }
+	    /**
+	     * Add the counts of the recorder to the given histograms.
+	     */
+	    void merge_into(snapshot_type& histograms) const noexcept;
+	    /**
+	     * Set all the counts to zero.
+	     */
+	    void clear() noexcept;
+	    /**
+	     * Return the recorder of the calling thread.
+	     */
+	    static recorder& local();
+    };
+
+#ifndef BST_LATENCY_SAMPLE_PERIOD
+    //! One operation in BST_LATENCY_SAMPLE_PERIOD is timed, every operation by default
+#define BST_LATENCY_SAMPLE_PERIOD 1
+#endif
+    static_assert(BST_LATENCY_SAMPLE_PERIOD >= 1, "BST_LATENCY_SAMPLE_PERIOD must be positive");
+
+    /**
+     * Timer class, records the time elapsed between its construction and its destruction as a
+     * latency of the given operation, unless it is nested in another timer of the same thread
+     * (e.g. the find made by operator[], or the inserts made by balance). When
+     * BST_LATENCY_SAMPLE_PERIOD is greater than 1 only one operation in that many is timed, the
+     * others costing a thread-local counter update instead of two reads of the clock.
+     */
+    class timer {
+
+	    //! state of the calling thread: nesting of the timers, operations until the next sample
+	    struct thread_state {
+		unsigned nesting{0}, countdown{0};
+	    };
+	    static thread_state& state() noexcept {
+		static thread_local thread_state s{};
+		return s;
+	    }
+
+	    operation op;
+	    bool timed;
+	    std::chrono::steady_clock::time_point start;
+
+	    static bool sample(thread_state& s) noexcept {
+		if (s.nesting++ != 0)
+		    return false;
+		if (s.countdown == 0) {
+		    s.countdown = BST_LATENCY_SAMPLE_PERIOD - 1;
+		    return true;
+		}
+		--s.countdown;
+		return false;
+	    }
+
+	public:
+	    explicit timer(const operation o) noexcept : op{o}, timed{sample(state())}, start{} {
+		if (timed)
+		    start = std::chrono::steady_clock::now();
+	    }
+	    ~timer() {
+		--state().nesting;
+		if (timed)
+		    recorder::local().record(op, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count()));
+	    }
+	    timer(const timer&) = delete;
+	    timer& operator=(const timer&) = delete;
+    };
+
+    /**
+     * Registry struct, the live recorders and the histograms of the exited threads.
+     */
+    struct registry {
+	std::mutex lock;
+	std::vector<const recorder*> live;
+	snapshot_type retired;
+
+	static registry& instance() {
+	    static registry r{};
+	    return r;
+	}
+    };
+}
+
+/*
+ * histogram::record function
+ */
+inline void BST_latency::histogram::record(const std::uint64_t ns) noexcept {
+
+    add(buckets::index(ns), 1, ns);
+}
+
+/*
+ * histogram::add function
+ */
+inline void BST_latency::histogram::add(const size_t bucket, const std::uint64_t count, const std::uint64_t bucket_sum) noexcept {
+
+    if (!count)
+	return;
+    counts[bucket] += count;
+    total += count;
+    sum += bucket_sum;
+    //a single latency is known exactly, otherwise the extremes are bounded by the bucket
+    const std::uint64_t highest{bucket + 1 < buckets::count ? buckets::lowest(bucket + 1) - 1 : ~std::uint64_t{0}};
+    smallest = std::min(smallest, count == 1 ? bucket_sum : buckets::lowest(bucket));
+    largest = std::max(largest, count == 1 ? bucket_sum : std::min(highest, bucket_sum));
+}
+
+/*
+ * histogram::merge function
+ */
+inline void BST_latency::histogram::merge(const histogram& other) noexcept {
+
+    for (size_t b{0}; b < counts.size(); ++b)
+	counts[b] += other.counts[b];
+    total += other.total;
+    sum += other.sum;
+    smallest = std::min(smallest, other.smallest);
+    largest = std::max(largest, other.largest);
+}
+
+/*
+ * histogram::quantile function
+ */
+inline std::uint64_t BST_latency::histogram::quantile(const double q) const noexcept {
+
+    if (!total)
+	return 0;
+    const std::uint64_t rank{std::max(std::uint64_t{1}, static_cast<std::uint64_t>(std::ceil(q * total)))};
+    std::uint64_t seen{0};
+    for (size_t b{0}; b < counts.size(); ++b) {
+	seen += counts[b];
+	if (seen >= rank)
+	    return std::min(largest, std::max(smallest, buckets::lowest(b)));
+    }
+    return largest;
+}
+
+/*
+ * recorder constructor
+ */
+inline BST_latency::recorder::recorder() : counts{}, sums{} {
+
+    registry& r{registry::instance()};
+    std::lock_guard<std::mutex> guard{r.lock};
+    r.live.push_back(this);
+}
+
+/*
+ * recorder destructor
+ */
+inline BST_latency::recorder::~recorder() {
+
+    registry& r{registry::instance()};
+    std::lock_guard<std::mutex> guard{r.lock};
+    merge_into(r.retired);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+}
+
+/*
+ * recorder::merge_into function
+ */
+inline void BST_latency::recorder::merge_into(snapshot_type& histograms) const noexcept {
+
+    for (size_t op{0}; op < operations; ++op)
+	for (size_t b{0}; b < buckets::count; ++b)
+	    histograms[op].add(b, counts[op][b].load(std::memory_order_relaxed), sums[op][b].load(std::memory_order_relaxed));
+}
+
+/*
+ * recorder::clear function
+ */
+inline void BST_latency::recorder::clear() noexcept {
+
+    for (size_t op{0}; op < operations; ++op)
+	for (size_t b{0}; b < buckets::count; ++b) {
+	    counts[op][b].store(0, std::memory_order_relaxed);
+	    sums[op][b].store(0, std::memory_order_relaxed);
+	}
+}
+
+/*
+ * recorder::local function
+ */
+inline BST_latency::recorder& BST_latency::recorder::local() {
+
+    static thread_local recorder r{};
+    return r;
+}
+
+/*
+ * snapshot function
+ */
+inline BST_latency::snapshot_type BST_latency::snapshot() {
+
+    registry& r{registry::instance()};
+    std::lock_guard<std::mutex> guard{r.lock};
+    snapshot_type result{r.retired};
+    for (const recorder* live : r.live)
+	live->merge_into(result);
+    return result;
+}
+
+/*
+ * reset function
+ */
+inline void BST_latency::reset() {
+
+    registry& r{registry::instance()};
+    std::lock_guard<std::mutex> guard{r.lock};
+    r.retired = snapshot_type{};
+    for (const recorder* live : r.live)
+	const_cast<recorder*>(live)->clear();
+}
+
+/*
+ * write_json function
+ */
+inline void BST_latency::write_json(std::ostream& os, const snapshot_type& histograms) {
+
+    os << "{";
+    for (size_t op{0}; op < operations; ++op) {
+	const histogram& h{histograms[op]};
+	os << (op ? ",\n " : "\n ") << "\"" << operation_names[op] << "\": {\"count\": " << h.count() << ", \"mean\": " << h.mean()
+	   << ", \"min\": " << h.min() << ", \"max\": " << h.max() << ", \"p50\": " << h.quantile(0.5)
+	   << ", \"p90\": " << h.quantile(0.9) << ", \"p99\": " << h.quantile(0.99) << ", \"p999\": " << h.quantile(0.999)
+	   << ", \"buckets\": [";
+	bool first{true};
+	h.for_each_bucket([&](const std::uint64_t lowest, const std::uint64_t count) {
+	    os << (first ? "" : ", ") << "[" << lowest << ", " << count << "]";
+	    first = false;
+	});
+	os << "]}";
+    }
+    os << "\n}\n";
+}
+
+
+#endif
@@ -0,0 +1,494 @@
+//: include/BST_storage.h
+
+#ifndef __BST_STORAGE_H__
+#define __BST_STORAGE_H__
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+
+/**
+ * Namespace containing the storage of the nodes of all BSTs. By default nodes are allocated one
+ * by one with operator new; in the other modes they are carved out of regions of 2MB, taken
+ * from a single range of address space reserved when such a mode is first selected (heap mode
+ * never reserves it), and recycled through free lists kept
+ * per thread and per node size. Regions are advised to be backed by transparent huge pages
+ * (huge_pages mode) or not (pages mode), so that lookups on large trees need one TLB entry
+ * per 2MB of nodes instead of one per 4KB. The mode is process-wide and can be changed at any
+ * time: it applies to the nodes allocated afterwards, while every node is freed according to
+ * where it lies, so trees may mix nodes allocated in different modes.
+ */
+namespace BST_storage {
+
+    //! Where new nodes are allocated
+    enum class mode {heap, pages, huge_pages};
+    //! Orders in which BST::compact lays out the nodes
+    enum class layout {breadth_first, van_emde_boas};
+
+    //! Counters of the regions of the arena
+    struct stats_type {
+	//! whether the address range of the regions is reserved: it is reserved by the first set_mode to
+	//! pages or huge_pages (or the first BST::compact), and if that fails nodes always come from the heap
+	bool available;
+	//! the current mode
+	mode current;
+	//! regions of 2MB carved so far for small pages and for huge pages
+	size_t page_regions, huge_regions;
+	//! regions for which the kernel refused huge pages, which are then backed by small pages
+	size_t huge_failures;
+    };
+
+    /**
+     * Set the mode in which new nodes are allocated. Return false, leaving the mode unchanged,
+     * if a mode other than heap is requested but the address range could not be reserved (or
+     * the platform is not Linux).
+     */
+    bool set_mode(const mode m) noexcept;
+    /**
+     * Return the mode in which new nodes are allocated.
+     */
+    mode current_mode() noexcept;
+    /**
+     * Return the counters of the regions.
+     */
+    stats_type stats() noexcept;
+
+    /**
+     * Arena class, the reserved address range, split into regions of 2MB. The range is mapped
+     * once, without reserving swap or memory, so that only the pages touched by nodes are ever
+     * backed; it is never unmapped, nodes being freed into the free lists of the pools.
+     */
+    class arena {
+
+	public:
+	    //! Size and alignment of a region, that of a huge page
+	    static constexpr size_t region_size{size_t{1} << 21};
+	    //! Address space reserved for the regions
+	    static constexpr size_t reserved_size{size_t{1} << 36};
+	    //! Number of regions in the reserved range
+	    static constexpr size_t region_count{reserved_size / region_size};
+
+	    /**
+	     * Return the arena, reserving its address range on first use. The arena is never
+	     * destroyed, since nodes of static trees may be freed at any point of the exit.
+	     */
+	    static arena& instance() {
+		static arena* a{create()};
+		return *a;
+	    }
+	    /**
+	     * Return the arena if instance has already created it, nullptr otherwise, so that
+	     * nodes can be freed without reserving the range in heap mode.
+	     */
+	    static const arena* created() noexcept {return existing.load(std::memory_order_acquire);}
+	    //! Whether the range could be reserved
+	    bool available() const noexcept {return base != 0;}
+	    //! Whether p lies in the reserved range
+	    bool owns(const void* p) const noexcept {return base && reinterpret_cast<std::uintptr_t>(p) - base < reserved_size;}
+	    //! Whether p lies in a region meant for huge pages, p being in the range
+	    bool huge(const void* p) const noexcept {
+		return kinds[(reinterpret_cast<std::uintptr_t>(p) - base) / region_size].load(std::memory_order_relaxed);
+	    }
+	    /**
+	     * Return a fresh span of whole regions covering at least the given number of bytes,
+	     * advised to be backed by huge pages or not, nullptr if the range is exhausted.
+	     */
+	    char* carve(const size_t bytes, const bool huge_pages) noexcept;
+
+	    //! The current mode, see set_mode, kept outside the arena so that heap mode never creates it
+	    static inline std::atomic<mode> selected{mode::heap};
+	    //! Counters of the regions, see stats
+	    std::atomic<size_t> page_regions{0}, huge_regions{0}, huge_failures{0};
+
+	private:
+	    //! First address of the range, 0 if it could not be reserved
+	    std::uintptr_t base{0};
+	    //! Bytes of the range carved so far
+	    std::atomic<size_t> used{0};
+	    //! Whether each region is meant for huge pages
+	    std::atomic<bool> kinds[region_count];
+
+	    //! The arena, once created
+	    static inline std::atomic<const arena*> existing{nullptr};
+
+	    arena() noexcept;
+	    static arena* create() {
+		arena* a{new arena{}};
+		existing.store(a, std::memory_order_release);
+		return a;
+	    }
+    };
+
+    /**
+     * Pool class, allocates and frees the slots of one node size. Each thread keeps, for small
+     * and for huge pages, a free list and the unused part of its current region, so that
+     * allocating and freeing take no lock; a slot freed by another thread joins the free list
+     * of that thread. When a thread exits its free lists and unused regions are handed to the
+     * other threads through a list protected by a mutex, which is also taken when refilling.
+     * Memory of freed nodes is reused for nodes of the same size, and is not returned to the
+     * system.
+     */
+    template <size_t Size, size_t Align>
+    class pool {
+
+	    //! Size of a slot: the node rounded up to its alignment, large enough to link free slots
+	    static constexpr size_t slot{(std::max(Size, sizeof(void*)) + Align - 1) / Align * Align};
+	    //! Whether nodes need more alignment than operator new guarantees
+	    static constexpr bool overaligned{Align > __STDCPP_DEFAULT_NEW_ALIGNMENT__};
+
+	    //! Slots of a thread for one kind of pages
+	    struct cache {
+		char* next;
+		char* end;
+		void* free;
+		bool retired;
+	    };
+	    //! Slots left by the threads which have exited, for one kind of pages
+	    struct orphans {
+		std::mutex lock;
+		void* free{nullptr};
+		std::vector<std::pair<char*, char*>> ranges;
+	    };
+	    //! Hands the caches of a thread over to the orphans when the thread exits
+	    struct releaser {
+		~releaser() {
+		    release(false);
+		    release(true);
+		}
+	    };
+
+	    /**
+	     * Make sure the caches of the calling thread are handed to the orphans when it exits,
+	     * once it keeps slots in them, be they refilled or freed.
+	     */
+	    static void enroll() noexcept {
+		static thread_local releaser r{}; //destroyed when the thread exits
+		(void)r;
+	    }
+	    static cache* local() noexcept {
+		static thread_local cache caches[2]{}; //trivially destructible, usable until the thread ends
+		return caches;
+	    }
+	    static orphans& adopted(const bool huge_pages) {
+		static orphans* o{new orphans[2]{}};
+		return o[huge_pages];
+	    }
+	    static void* heap_allocate(const size_t size) {
+		if constexpr (overaligned)
+		    return ::operator new(size, std::align_val_t{Align});
+		else
+		    return ::operator new(size);
+	    }
+	    static void heap_free(void* p) noexcept {
+		if constexpr (overaligned)
+		    ::operator delete(p, std::align_val_t{Align});
+		else
+		    ::operator delete(p);
+	    }
+	    static void push(void*& list, void* p) noexcept {
+		*static_cast<void**>(p) = list;
+		list = p;
+	    }
+	    /**
+	     * Give a cache that has no slot left a new source of slots: the orphans, or else a new region.
+	     */
+	    static bool refill(cache& c, const bool huge_pages);
+	    /**
+	     * Move the slots of a cache of the calling thread to the orphans, and retire it.
+	     */
+	    static void release(const bool huge_pages);
+	    /**
+	     * Return count consecutive free slots, taken from the orphans and the caches of the
+	     * calling thread, nullptr if there is no such run; the other slots are left to the orphans.
+	     */
+	    static char* reuse(const size_t count, const bool huge_pages);
+
+	public:
+	    /**
+	     * Return storage for a node, from the pool unless the mode is heap.
+	     */
+	    static void* allocate(const size_t size);
+	    /**
+	     * Free storage returned by allocate, or a slot of a block. Slots freed in heap mode go
+	     * to the orphans, where later pooled allocations and blocks find them.
+	     */
+	    static void deallocate(void* p) noexcept;
+	    /**
+	     * Return storage for count nodes laid out one after the other, stride() bytes apart,
+	     * made of free slots that happen to be consecutive, such as those of a block freed
+	     * earlier, or else carved from fresh regions (backed by huge pages in huge_pages mode,
+	     * by small pages otherwise), nullptr if the range is not available or exhausted. The
+	     * slots are freed one by one through deallocate, and the rest of the last region is left
+	     * to the pool.
+	     */
+	    static char* allocate_block(const size_t count);
+	    //! Distance in bytes between consecutive nodes of a block
+	    static constexpr size_t stride() noexcept {return slot;}
+    };
+}
+
+/*
+ * arena constructor
+ */
+inline BST_storage::arena::arena() noexcept : kinds{} {
+#ifdef __linux__
+    void* p{mmap(nullptr, reserved_size + region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)};
+    if (p != MAP_FAILED) //align the regions on huge pages
+	base = (reinterpret_cast<std::uintptr_t>(p) + region_size - 1) & ~(region_size - 1);
+#endif
+}
+
+/*
+ * arena::carve function
+ */
+inline char* BST_storage::arena::carve(const size_t bytes, const bool huge_pages) noexcept {
+
+    if (!available())
+	return nullptr;
+    const size_t span{(bytes + region_size - 1) / region_size * region_size};
+    const size_t offset{used.fetch_add(span, std::memory_order_relaxed)};
+    if (offset + span > reserved_size)
+	return nullptr;
+    char* start{reinterpret_cast<char*>(base + offset)};
+    for (size_t r{offset / region_size}; r < (offset + span) / region_size; ++r)
+	kinds[r].store(huge_pages, std::memory_order_relaxed);
+#ifdef __linux__
+    if (huge_pages) {
+#ifdef MADV_HUGEPAGE
+	if (madvise(start, span, MADV_HUGEPAGE) != 0)
+	    huge_failures.fetch_add(span / region_size, std::memory_order_relaxed);
+#else
+	huge_failures.fetch_add(span / region_size, std::memory_order_relaxed);
+#endif
+    }
+#ifdef MADV_NOHUGEPAGE
+    else {
+	madvise(start, span, MADV_NOHUGEPAGE); //keep small pages even where huge pages are the default
+    }
+#endif
+#endif
+    (huge_pages ? huge_regions : page_regions).fetch_add(span / region_size, std::memory_order_relaxed);
+    return start;
+}
+
+/*
+ * set_mode function
+ */
+inline bool BST_storage::set_mode(const mode m) noexcept {
+
+    if (m != mode::heap && !arena::instance().available())
+	return false;
+    arena::selected.store(m, std::memory_order_relaxed);
+    return true;
+}
+
+/*
+ * current_mode function
+ */
+inline BST_storage::mode BST_storage::current_mode() noexcept {
+
+    return arena::selected.load(std::memory_order_relaxed);
+}
+
+/*
+ * stats function
+ */
+inline BST_storage::stats_type BST_storage::stats() noexcept {
+
+    const mode m{arena::selected.load(std::memory_order_relaxed)};
+    const arena* a{arena::created()};
+    if (!a)
+	return stats_type{false, m, 0, 0, 0};
+    return stats_type{a->available(), m, a->page_regions.load(std::memory_order_relaxed),
+		      a->huge_regions.load(std::memory_order_relaxed), a->huge_failures.load(std::memory_order_relaxed)};
+}
+
+/*
+ * pool::allocate function
+ */
+template <size_t Size, size_t Align>
+void* BST_storage::pool<Size, Align>::allocate(const size_t size) {
+
+    const mode m{arena::selected.load(std::memory_order_relaxed)};
+    if (m == mode::heap || size != Size) //before touching the arena, which heap mode never creates
+	return heap_allocate(size);
+    const bool huge_pages{m == mode::huge_pages};
+    cache& c{local()[huge_pages]};
+    while (!c.retired) {
+	if (c.free) { //reuse a freed slot first
+	    void* p{c.free};
+	    c.free = *static_cast<void**>(p);
+	    return p;
+	}
+	if (static_cast<size_t>(c.end - c.next) >= slot) {
+	    void* p{c.next};
+	    c.next += slot;
+	    return p;
+	}
+	if (!refill(c, huge_pages))
+	    break;
+    }
+    return heap_allocate(size); //the range is exhausted, or the thread is exiting
+}
+
+/*
+ * pool::deallocate function
+ */
+template <size_t Size, size_t Align>
+void BST_storage::pool<Size, Align>::deallocate(void* p) noexcept {
+
+    const arena* a{arena::created()};
+    if (!a || !a->owns(p)) { //without an arena every node comes from the heap
+	heap_free(p);
+	return;
+    }
+    const bool huge_pages{a->huge(p)};
+    cache& c{local()[huge_pages]};
+    if (!c.retired && arena::selected.load(std::memory_order_relaxed) != mode::heap) { //heap mode never reads the caches
+	enroll(); //a thread that only frees slots hands them over as well
+	push(c.free, p);
+	return;
+    }
+    orphans& o{adopted(huge_pages)};
+    std::lock_guard<std::mutex> guard{o.lock};
+    push(o.free, p);
+}
+
+/*
+ * pool::allocate_block function
+ */
+template <size_t Size, size_t Align>
+char* BST_storage::pool<Size, Align>::allocate_block(const size_t count) {
+
+    if (!count)
+	return nullptr;
+    arena& a{arena::instance()};
+    const bool huge_pages{arena::selected.load(std::memory_order_relaxed) == mode::huge_pages};
+    if (char* reused{reuse(count, huge_pages)})
+	return reused;
+    char* block{a.carve(count * slot, huge_pages)};
+    if (!block)
+	return nullptr;
+    const size_t span{(count * slot + arena::region_size - 1) / arena::region_size * arena::region_size};
+    if (span - count * slot >= slot) { //the rest of the last region serves later allocations
+	orphans& o{adopted(huge_pages)};
+	std::lock_guard<std::mutex> guard{o.lock};
+	o.ranges.emplace_back(block + count * slot, block + span);
+    }
+    return block;
+}
+
+/*
+ * pool::reuse function
+ */
+template <size_t Size, size_t Align>
+char* BST_storage::pool<Size, Align>::reuse(const size_t count, const bool huge_pages) {
+
+    cache& c{local()[huge_pages]};
+    orphans& o{adopted(huge_pages)};
+    std::lock_guard<std::mutex> guard{o.lock};
+    std::vector<std::pair<char*, char*>> spans{o.ranges}; //every free span, a slot being a span too
+    if (!c.retired && static_cast<size_t>(c.end - c.next) >= slot)
+	spans.emplace_back(c.next, c.end);
+    const size_t ranges{spans.size()};
+    for (void* list : {o.free, c.retired ? nullptr : c.free})
+	for (void* p{list}; p; p = *static_cast<void**>(p))
+	    spans.emplace_back(static_cast<char*>(p), static_cast<char*>(p) + slot);
+    std::sort(spans.begin(), spans.end());
+
+    char *start{nullptr}, *end{nullptr}; //run of whole slots being extended, open if it ends where its last span does
+    bool open{false};
+    for (const auto& span : spans) {
+	if (!(open && span.first == end))
+	    start = end = span.first;
+	end += static_cast<size_t>(span.second - span.first) / slot * slot;
+	open = end == span.second;
+	if (static_cast<size_t>(end - start) >= count * slot)
+	    break;
+    }
+    if (!start || static_cast<size_t>(end - start) < count * slot)
+	return nullptr;
+
+    std::vector<std::pair<char*, char*>> kept; //spans left after taking [start, taken)
+    kept.reserve(ranges + 1);
+    char* const taken{start + count * slot};
+    o.free = nullptr;
+    if (!c.retired) {
+	c.free = nullptr;
+	c.next = c.end = nullptr;
+    }
+    for (const auto& span : spans) {
+	char* const from{span.first < taken && span.second > start ? taken : span.first};
+	if (static_cast<size_t>(span.second - from) < slot || (span.first >= start && span.second <= taken))
+	    continue;
+	if (static_cast<size_t>(span.second - from) == slot)
+	    push(o.free, from);
+	else
+	    kept.emplace_back(from, span.second);
+    }
+    o.ranges.swap(kept);
+    return start;
+}
+
+/*
+ * pool::refill function
+ */
+template <size_t Size, size_t Align>
+bool BST_storage::pool<Size, Align>::refill(cache& c, const bool huge_pages) {
+
+    enroll();
+    {
+	orphans& o{adopted(huge_pages)};
+	std::lock_guard<std::mutex> guard{o.lock};
+	if (o.free) {
+	    c.free = o.free;
+	    o.free = nullptr;
+	    return true;
+	}
+	if (!o.ranges.empty()) {
+	    std::tie(c.next, c.end) = o.ranges.back();
+	    o.ranges.pop_back();
+	    return true;
+	}
+    }
+    char* region{arena::instance().carve(arena::region_size, huge_pages)};
+    if (!region)
+	return false;
+    c.next = region;
+    c.end = region + arena::region_size;
+    return true;
+}
+
+/*
+ * pool::release function
+ */
+template <size_t Size, size_t Align>
+void BST_storage::pool<Size, Align>::release(const bool huge_pages) {
+
+    cache& c{local()[huge_pages]};
+    orphans& o{adopted(huge_pages)};
+    std::lock_guard<std::mutex> guard{o.lock};
+    while (c.free) {
+	void* p{c.free};
+	c.free = *static_cast<void**>(p);
+	push(o.free, p);
+    }
+    if (static_cast<size_t>(c.end - c.next) >= slot)
+	o.ranges.emplace_back(c.next, c.end);
+    c.next = c.end = nullptr;
+    c.retired = true;
+}
+
+
+#endif
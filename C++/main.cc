@@ -1,118 +1,874 @@
 #include "BST.h"
+#include "BST_benchmark.h"
 #include <string>
-#include <array>
 #include <map>
-#include <random>
+#include <unordered_map>
 #include <chrono>
+#include <stdexcept>
+#include <new>
+#include <cstdlib>
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <random>
 #include <iostream>
+#include <cstdint>
 
 
-int main(){
-#ifdef __BST_DEV__
-    BST_testing::Tester t;
-    t.test();
-#else
+/*
+ * Replacements of the global operator new and operator delete, counting the allocations and
+ * the bytes allocated by the whole program (the array and nothrow forms rely on these).
+ * Over-aligned allocations are not counted. operator delete is kept out of line, otherwise
+ * GCC sees std::free applied to the result of operator new once both are inlined, and warns.
+ */
+void* operator new(std::size_t size) {
+
+    void* p{std::malloc(size ? size : 1)};
+    if (!p)
+	throw std::bad_alloc{};
+    BST_benchmark::heap_allocations.fetch_add(1, std::memory_order_relaxed);
+#ifdef __GLIBC__
+    BST_benchmark::heap_bytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+#endif
+    return p;
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+
+    if (!p)
+	return;
+#ifdef __GLIBC__
+    BST_benchmark::heap_bytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+#endif
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+
+    ::operator delete(p);
+}
+
+
+namespace {
+
     using bst_type = BST<size_t, std::string>;
+    using map_type = std::map<size_t, std::string>;
+    using hash_type = std::unordered_map<size_t, std::string>;
+    using BST_benchmark::Options;
+    using BST_benchmark::Report;
+    using BST_benchmark::Record;
+
+    //!A suite of benchmarks, adding its records to the report
+    using suite_type = void (*)(const Options&, Report&);
+
+    /**
+     * Time full in-order scans, repeated fewer times than lookups since each one touches
+     * every element, and return the time per element.
+     * @param options options of the run
+     * @param size number of elements scanned
+     * @param scan function object performing a scan and returning a checksum
+     * @param counts receives the hardware events per element
+     */
+    template <class F>
+    BST_benchmark::Summary time_scans(const Options& options, const size_t size, F scan, BST_benchmark::Counts& counts) {
+	Options scans{options};
+	scans.warmup = 1;
+	scans.batch = 1;
+	scans.repetitions = std::max(size_t{3}, std::min(options.repetitions, size_t{10000000} / size));
+	auto samples = BST_benchmark::run_batches(scans, [&scan](size_t) { return scan(); }, &counts);
+	for (auto& x : samples)
+	    x /= size;
+	for (auto& x : counts.values)
+	    x /= size;
+	return BST_benchmark::summarize(samples);
+    }
+
+    /**
+     * Time op in batches and return its record, along with the hardware events per operation
+     * of the measured batches.
+     */
+    template <class F>
+    Record measure(const Options& options, const std::string& suite, const std::string& structure,
+		   const std::string& workload, const size_t size, F op) {
+	Record record{suite, structure, workload, size, {}};
+	record.stats = BST_benchmark::summarize(BST_benchmark::run_batches(options, op, &record.counts));
+	return record;
+    }
 
-    const size_t N{3};
-    const size_t k{15};
-    const int searches{50};
-    
-    bst_type bst{};
-    std::map<size_t, std::string> map{};
-
-    std::array<long int, searches> bst_times, map_times;
-    std::random_device rand_dev;
-    std::mt19937 generator{rand_dev()};
-    std::uniform_int_distribution<size_t> rand;
-
-
-    std::cout << "** Unbalanced test **" << std::endl;
-    for (size_t run{0}; run < k; run++){
-    
-	size_t size{N};
-	for (size_t j{0}; j < run; j++)
-	    size *= N;
-
-	std::cout << "Running with size = " << size << std::endl;
-
-	while (map.size() < size){
-	
-	    size_t num{rand(generator)};
-	    bst.insert(num, std::to_string(num));
-	    map.insert(std::map<size_t,std::string>::value_type{num, std::to_string(num)});
+    /**
+     * Lookup suite: for each size, random keys are inserted in a BST and in an std::map, and
+     * find is timed on keys that are present (hit) and on keys that are not (miss). The BST is
+     * benchmarked as built, after balance, after compact in breadth first and in van Emde Boas
+     * order, with the hash index and with the membership filter.
+     * Full scans and the teardown of the structures are timed as well.
+     */
+    void lookup_suite(const Options& options, Report& report) {
+
+	std::mt19937_64 generator{options.seed};
+	std::uniform_int_distribution<size_t> rand{0, ~size_t{0} >> 1};
+	const size_t ops{(options.warmup + options.repetitions) * options.batch};
+
+	for (const size_t size : options.sizes()) {
+
+	    bst_type bst{};
+	    map_type map{};
+	    std::vector<size_t> hits, misses;
+	    while (bst.size() < size) { //present keys are even, absent ones are odd
+		const size_t num{rand(generator) << 1};
+		bst.insert(num, std::to_string(num));
+		map.insert(map_type::value_type{num, std::to_string(num)});
+	    }
+	    for (const auto& x : map)
+		hits.push_back(x.first);
+	    std::shuffle(hits.begin(), hits.end(), generator);
+	    for (size_t i{0}; i < std::min(ops, size_t{1} << 20); ++i)
+		misses.push_back((rand(generator) << 1) | 1);
+
+	    auto lookups = [&](const std::string& structure, auto& tree) {
+		auto find_hit = [&](size_t i) { return tree.find(hits[i % hits.size()]) != tree.end(); };
+		auto find_miss = [&](size_t i) { return tree.find(misses[i % misses.size()]) != tree.end(); };
+		report.add(measure(options, "lookup", structure, "hit", size, find_hit));
+		report.add(measure(options, "lookup", structure, "miss", size, find_miss));
+	    };
+	    lookups("bst", bst);
+	    bst.balance();
+	    lookups("bst_balanced", bst);
+	    bst.compact(BST_storage::layout::breadth_first);
+	    lookups("bst_bfs", bst);
+	    bst.compact(BST_storage::layout::van_emde_boas);
+	    lookups("bst_veb", bst);
+	    bst.enable_index();
+	    lookups("bst_index", bst);
+	    bst.disable_index();
+	    bst.enable_filter();
+	    lookups("bst_filter", bst);
+	    bst.disable_filter();
+	    lookups("map", map);
+
+	    Record bst_iterator{"lookup", "bst_balanced", "scan_iterator", size, {}};
+	    bst_iterator.stats = time_scans(options, size, [&bst]() {
+		size_t sum{0};
+		for (const auto& x : bst)
+		    sum += x.first;
+		return sum;
+	    }, bst_iterator.counts);
+	    report.add(bst_iterator);
+	    Record bst_visit{"lookup", "bst_balanced", "scan_visit", size, {}};
+	    bst_visit.stats = time_scans(options, size, [&bst]() {
+		size_t sum{0};
+		bst.visit_inorder([&sum](const bst_type::pair_type& x) { sum += x.first; });
+		return sum;
+	    }, bst_visit.counts);
+	    report.add(bst_visit);
+	    Record map_iterator{"lookup", "map", "scan_iterator", size, {}};
+	    map_iterator.stats = time_scans(options, size, [&map]() {
+		size_t sum{0};
+		for (const auto& x : map)
+		    sum += x.first;
+		return sum;
+	    }, map_iterator.counts);
+	    report.add(map_iterator);
+
+	    Record bst_clear{"lookup", "bst_balanced", "clear", size, {}};
+	    bst_clear.stats = BST_benchmark::summarize({BST_benchmark::run_once(size, [&bst]() { bst.clear(); }, &bst_clear.counts)});
+	    report.add(bst_clear);
+	    Record map_clear{"lookup", "map", "clear", size, {}};
+	    map_clear.stats = BST_benchmark::summarize({BST_benchmark::run_once(size, [&map]() { map.clear(); }, &map_clear.counts)});
+	    report.add(map_clear);
 	}
+    }
 
-	for (int search{0}; search < searches; search++){
-	
-	    size_t item{rand(generator)};
-	    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
-	    bst.find(item);
-	    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-	    bst_times[search] = std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
-	    start = std::chrono::high_resolution_clock::now();
-	    map.find(item);
-	    end = std::chrono::high_resolution_clock::now();
-	    map_times[search] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    /**
+     * Operations of the YCSB suite on the benchmarked structures: the generic versions apply
+     * to the standard containers, the overloads to the BST and to the unordered map.
+     */
+    template <class T>
+    size_t ycsb_read(T& store, const size_t key) {
+	auto it = store.find(key);
+	return it == store.end() ? 0 : (*it).second.size();
+    }
+    template <class T>
+    void ycsb_update(T& store, const size_t key, const std::string& value) {
+	auto it = store.find(key);
+	if (it != store.end())
+	    (*it).second = value;
+    }
+    template <class T>
+    void ycsb_insert(T& store, const size_t key, const std::string& value) {
+	store.emplace(key, value);
+    }
+    void ycsb_insert(bst_type& store, const size_t key, const std::string& value) {
+	store.insert(key, value);
+    }
+    template <class T>
+    size_t ycsb_scan(T& store, const size_t key, const size_t length) {
+	size_t sum{0}, n{0};
+	for (auto it = store.lower_bound(key); it != store.end() && n < length; ++it, ++n)
+	    sum += it->second.size();
+	return sum;
+    }
+    size_t ycsb_scan(hash_type&, const size_t, const size_t) {
+	throw std::logic_error{"hash tables do not support scans"};
+    }
+    size_t ycsb_scan(bst_type& store, const size_t key, const size_t length) {
+	bst_type::cursor_type::entry_type buffer[16]; //read in chunks, so that scans allocate no more than those of std::map
+	auto cursor = store.cursor(key);
+	size_t sum{0};
+	for (size_t left{length}, n; left > 0 && (n = cursor.next(buffer, std::min(left, size_t{16}))) > 0; left -= n)
+	    for (size_t i{0}; i < n; ++i)
+		sum += buffer[i].second->size();
+	return sum;
+    }
+
+    /**
+     * YCSB suite: for each size and each selected core workload (A to F), a BST, an std::map and
+     * an std::unordered_map are loaded with that many records and then run the same generated
+     * sequence of operations. After the warmup operations, repetitions * batch operations are
+     * timed as a whole to get the throughput, then as many are timed one by one, minus the overhead
+     * of the clock, to get the latencies of each kind of operation. The unordered map does not
+     * support scans, so it skips the workloads having any. Hardware events are counted over the
+     * throughput block.
+     */
+    void ycsb_suite(const Options& options, Report& report) {
+
+	const std::string value(options.value_size, 'v');
+	const size_t timed{options.repetitions * options.batch}, warmup{options.warmup * options.batch};
+	const double overhead{BST_benchmark::clock_overhead()};
+	std::cout << "clock overhead " << overhead << " ns, values of " << options.value_size << " bytes" << std::endl;
+
+	for (const size_t size : options.sizes()) {
+	    for (const char letter : options.workload) {
+
+		const BST_benchmark::Mix mix{BST_benchmark::Mix::core(letter)};
+		const std::string distribution{options.distribution.empty() ? mix.distribution : options.distribution};
+		const auto requests = BST_benchmark::generate(mix, distribution, size, warmup + 2 * timed, options.seed + size);
+
+		auto run = [&](const std::string& structure, auto& store) {
+		    for (size_t i{0}; i < size; ++i)
+			ycsb_insert(store, BST_benchmark::record_key(i), value);
+		    auto execute = [&](const BST_benchmark::Request& r) {
+			const size_t key{BST_benchmark::record_key(r.record)};
+			switch (r.operation) {
+			    case BST_benchmark::Operation::read: BST_benchmark::sink += ycsb_read(store, key); break;
+			    case BST_benchmark::Operation::update: ycsb_update(store, key, value); break;
+			    case BST_benchmark::Operation::insert: ycsb_insert(store, key, value); break;
+			    case BST_benchmark::Operation::scan: BST_benchmark::sink += ycsb_scan(store, key, r.length); break;
+			    case BST_benchmark::Operation::read_modify_write:
+				BST_benchmark::sink += ycsb_read(store, key);
+				ycsb_update(store, key, value);
+				break;
+			}
+		    };
+		    for (size_t i{0}; i < warmup; ++i)
+			execute(requests[i]);
+
+		    BST_benchmark::Counters::instance().start();
+		    const auto start = std::chrono::steady_clock::now();
+		    for (size_t i{warmup}; i < warmup + timed; ++i)
+			execute(requests[i]);
+		    const double elapsed{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+		    const BST_benchmark::Counts counts{BST_benchmark::Counters::instance().stop(timed)};
+
+		    std::vector<double> all, latencies[5];
+		    for (size_t i{warmup + timed}; i < requests.size(); ++i) {
+			const auto begin = std::chrono::steady_clock::now();
+			execute(requests[i]);
+			const auto end = std::chrono::steady_clock::now();
+			const double ns{std::max(0.0, std::chrono::duration<double, std::nano>(end - begin).count() - overhead)};
+			latencies[static_cast<size_t>(requests[i].operation)].push_back(ns);
+			all.push_back(ns);
+		    }
+		    BST_benchmark::Record total{"ycsb", structure, mix.name + "_" + distribution, size, BST_benchmark::summarize(all)};
+		    total.throughput = timed / elapsed;
+		    total.counts = counts;
+		    report.add(total);
+		    for (size_t op{0}; op < 5; ++op)
+			if (!latencies[op].empty())
+			    report.add({"ycsb", structure, mix.name + "_" + BST_benchmark::operation_names[op], size,
+					BST_benchmark::summarize(latencies[op])});
+		};
+
+		{
+		    bst_type bst{};
+		    run("bst", bst);
+		}
+		{
+		    map_type map{};
+		    run("map", map);
+		}
+		if (mix.scan == 0) {
+		    hash_type hash{};
+		    run("unordered_map", hash);
+		}
+	    }
 	}
+    }
+
+    /**
+     * Measure the memory taken by trees of the given types and return the records of a BST and
+     * of an std::map holding the given keys.
+     * @param types name of the key and value types, appended to the structure names
+     * @param keys keys to insert, in order of insertion
+     * @param value function object returning the value of a key
+     */
+    template <class K, class V, class F>
+    void memory_case(const std::string& types, const std::vector<K>& keys, F value, Report& report) {
+
+	const size_t size{keys.size()};
+	auto record = [&](const std::string& structure, const std::string& metric, const double x, const std::string& unit) {
+	    Record r{"memory", structure + types, metric, size, BST_benchmark::summarize({x})};
+	    r.unit = unit;
+	    report.add(r);
+	};
+	auto allocations_since = [](const size_t start) {
+	    return static_cast<double>(BST_benchmark::heap_allocations.load() - start);
+	};
+
+	auto measure_tree = [&](const std::string& structure, auto& tree, auto insert) {
+	    BST_benchmark::release_memory();
+	    const size_t bytes{BST_benchmark::heap_bytes.load()}, resident{BST_benchmark::resident_bytes()};
+	    const size_t allocations{BST_benchmark::heap_allocations.load()};
+	    for (const auto& k : keys)
+		insert(tree, k, value(k));
+	    record(structure, "heap", static_cast<double>(BST_benchmark::heap_bytes.load() - bytes) / size, "B/elem");
+	    record(structure, "rss", static_cast<double>(BST_benchmark::resident_bytes() - std::min(resident, BST_benchmark::resident_bytes())) / size, "B/elem");
+	    record(structure, "allocs_insert", allocations_since(allocations) / size, "allocs/op");
 
-	std::cout << "bst_times: [";
-	for (auto x : bst_times)
-	    std::cout << x << ", ";
-	std::cout << "\b\b" << "]" << std::endl;
-	std::cout << "map_times: [";
-	for (auto x : map_times)
-	    std::cout << x << ", ";
-	std::cout << "\b\b" << "]" << std::endl;
-
-	bst.clear();
-	map.clear();
-    }
-
-    std::cout << "** Balanced test **" << std::endl;
-    for (size_t run{0}; run < k; run++){
-    
-	size_t size{N};
-	for (size_t j{0}; j < run; j++)
-	    size *= N;
-
-	std::cout << "Running with size = " << size << std::endl;
-
-	for (size_t j{1}; j <= size; j++){
-	
-	    size_t num{rand(generator)};
-	    bst.insert(num, std::to_string(num));
-	    map.insert(std::map<size_t,std::string>::value_type{num, std::to_string(num)});
+	    const size_t before_copy{BST_benchmark::heap_allocations.load()};
+	    {
+		const auto copy{tree};
+		record(structure, "allocs_copy", allocations_since(before_copy) / size, "allocs/elem");
+	    }
+	};
+
+	{
+	    BST<K, V> bst{};
+	    measure_tree("bst", bst, [](BST<K, V>& t, const K& k, V v) { t.insert(k, std::move(v)); });
+	    const size_t before_balance{BST_benchmark::heap_allocations.load()};
+	    bst.balance();
+	    record("bst", "allocs_balance", allocations_since(before_balance) / size, "allocs/elem");
 	}
-	bst.balance();
-
-	for (int search{0}; search < searches; search++){
-	
-	    size_t item{rand(generator)};
-	    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
-	    bst.find(item);
-	    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
-	    bst_times[search] = std::chrono::duration_cast<std::chrono::nanoseconds>( end - start ).count();
-	    start = std::chrono::high_resolution_clock::now();
-	    map.find(item);
-	    end = std::chrono::high_resolution_clock::now();
-	    map_times[search] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	{
+	    std::map<K, V> map{};
+	    measure_tree("map", map, [](std::map<K, V>& t, const K& k, V v) { t.emplace(k, std::move(v)); });
 	}
+    }
+
+    /**
+     * Memory suite: for each size, trees with random keys are built for several key and value
+     * types (64 bits integers, short strings which fit in the small string buffer, and URLs
+     * which do not), and the suite reports the heap bytes per element counted by the replaced
+     * operator new, the growth of the resident set size per element, and the allocations per
+     * insert, per element copied by the copy constructor and per element during balance.
+     */
+    void memory_suite(const Options& options, Report& report) {
 
-	std::cout << "bst_times: [";
-	for (auto x : bst_times)
-	    std::cout << x << ", ";
-	std::cout << "\b\b" << "]" << std::endl;
-	std::cout << "map_times: [";
-	for (auto x : map_times)
-	    std::cout << x << ", ";
-	std::cout << "\b\b" << "]" << std::endl;
+	std::mt19937_64 generator{options.seed};
+	for (const size_t size : options.sizes()) {
 
-	bst.clear();
-	map.clear();
+	    std::vector<size_t> numbers;
+	    std::unordered_map<size_t, bool> seen;
+	    while (numbers.size() < size) {
+		const size_t n{generator()};
+		if (seen.emplace(n, true).second)
+		    numbers.push_back(n);
+	    }
+	    seen.clear();
+	    memory_case<size_t, size_t>("<u64,u64>", numbers, [](size_t k) { return k; }, report);
+	    memory_case<size_t, std::string>("<u64,str>", numbers, [](size_t k) { return std::to_string(k % 1000000); }, report);
+	    std::vector<std::string> urls;
+	    for (const size_t n : numbers)
+		urls.push_back("https://www.example.com/catalog/item/" + std::to_string(n));
+	    memory_case<std::string, size_t>("<url,u64>", urls, [](const std::string& k) { return k.size(); }, report);
+	}
     }
 
-#endif
+    /**
+     * An order of insertion of the keys 0, ..., n - 1, which are then doubled so that odd keys
+     * are never present. degenerate orders build trees at least sqrt(n) tall, so that building
+     * them takes superlinear time (quadratic for the chains).
+     */
+    struct Order {
+	std::string name;
+	bool degenerate;
+	std::vector<size_t> (*keys)(size_t n, std::mt19937_64& generator);
+    };
+
+    const Order orders[]{
+	{"uniform", false, [](size_t n, std::mt19937_64& generator) {
+	    std::vector<size_t> keys(n);
+	    for (size_t i{0}; i < n; ++i) keys[i] = i;
+	    std::shuffle(keys.begin(), keys.end(), generator);
+	    return keys;
+	}},
+	{"sorted", true, [](size_t n, std::mt19937_64&) {
+	    std::vector<size_t> keys(n);
+	    for (size_t i{0}; i < n; ++i) keys[i] = i;
+	    return keys;
+	}},
+	{"reverse", true, [](size_t n, std::mt19937_64&) {
+	    std::vector<size_t> keys(n);
+	    for (size_t i{0}; i < n; ++i) keys[i] = n - 1 - i;
+	    return keys;
+	}},
+	{"zigzag", true, [](size_t n, std::mt19937_64&) { //0, n - 1, 1, n - 2, ... each key falls between the last two
+	    std::vector<size_t> keys;
+	    for (size_t lo{0}, hi{n}; lo < hi; ++lo) {
+		keys.push_back(lo);
+		if (lo < --hi)
+		    keys.push_back(hi);
+	    }
+	    return keys;
+	}},
+	{"clustered", false, [](size_t n, std::mt19937_64& generator) { //runs of 256 sorted keys, runs in random order
+	    const size_t run{256};
+	    std::vector<size_t> starts;
+	    for (size_t i{0}; i < n; i += run) starts.push_back(i);
+	    std::shuffle(starts.begin(), starts.end(), generator);
+	    std::vector<size_t> keys;
+	    for (const size_t start : starts)
+		for (size_t i{start}; i < std::min(n, start + run); ++i) keys.push_back(i);
+	    return keys;
+	}},
+	{"sawtooth", true, [](size_t n, std::mt19937_64&) { //sqrt(n) increasing teeth r, r + t, r + 2t, ...
+	    const size_t teeth{std::max(size_t{1}, static_cast<size_t>(std::sqrt(static_cast<double>(n))))};
+	    std::vector<size_t> keys;
+	    for (size_t r{0}; r < teeth; ++r)
+		for (size_t i{r}; i < n; i += teeth) keys.push_back(i);
+	    return keys;
+	}},
+    };
+
+    /**
+     * Orders suite: for each size and each insertion order (uniform, sorted, reverse sorted,
+     * zig-zag, clustered and sawtooth), a BST is built and the suite reports the time per insert
+     * along with the insertion throughput, the height, the time of find on present keys, the
+     * time of balance per element, and then height and find again after balance. Lookups are
+     * repeated less on tall trees, so that each measurement visits about as many nodes. Degenerate
+     * orders are skipped for sizes above 2^16, which would take minutes to build.
+     */
+    void orders_suite(const Options& options, Report& report) {
+
+	const size_t degenerate_limit{size_t{1} << 16}, budget{50000000}; //nodes visited by the lookups of a measurement
+	std::mt19937_64 generator{options.seed};
+
+	for (const size_t size : options.sizes()) {
+	    for (const Order& order : orders) {
+
+		if (order.degenerate && size > degenerate_limit)
+		    continue;
+		const std::string structure{"bst/" + order.name};
+		std::vector<size_t> keys{order.keys(size, generator)};
+		for (auto& key : keys)
+		    key <<= 1;
+		std::vector<std::string> values;
+		for (const size_t key : keys)
+		    values.push_back(std::to_string(key));
+		std::vector<size_t> hits{keys};
+		std::shuffle(hits.begin(), hits.end(), generator);
 
+		bst_type bst{};
+		Record insert{"orders", structure, "insert", size, {}};
+		const double per_insert{BST_benchmark::run_once(size, [&]() {
+		    for (size_t i{0}; i < size; ++i)
+			bst.insert(keys[i], values[i]);
+		}, &insert.counts)};
+		insert.stats = BST_benchmark::summarize({per_insert});
+		insert.throughput = 1e9 / per_insert;
+		report.add(insert);
+
+		auto shape = [&](const std::string& workload) {
+		    const size_t height{bst.height()};
+		    Record record{"orders", structure, workload, size, BST_benchmark::summarize({static_cast<double>(height)})};
+		    record.unit = "levels";
+		    report.add(record);
+		    Options lookups{options};
+		    lookups.repetitions = std::max(size_t{3}, std::min(options.repetitions, budget / (options.batch * height)));
+		    lookups.warmup = std::min(options.warmup, lookups.repetitions);
+		    return lookups;
+		};
+		auto find_hit = [&](size_t i) { return bst.find(hits[i % hits.size()]) != bst.end(); };
+
+		report.add(measure(shape("height"), "orders", structure, "find", size, find_hit));
+		Record balance{"orders", structure, "balance", size, {}};
+		balance.stats = BST_benchmark::summarize({BST_benchmark::run_once(size, [&bst]() { bst.balance(); }, &balance.counts)});
+		report.add(balance);
+		report.add(measure(shape("height_balanced"), "orders", structure, "find_balanced", size, find_hit));
+	    }
+	}
+    }
+
+    /**
+     * Composite key of the types suite, ordered by tenant and then by timestamp.
+     */
+    struct Tenant_key {
+	std::uint32_t tenant;
+	std::uint64_t timestamp;
+	bool operator<(const Tenant_key& other) const noexcept {
+	    return tenant != other.tenant ? tenant < other.tenant : timestamp < other.timestamp;
+	}
+    };
+
+    //!Plain value of 256 bytes, copied byte by byte
+    struct Fat_value {
+	unsigned char bytes[256];
+    };
+
+    /**
+     * Comparison of strings equivalent to std::less, but being a different type it keeps the
+     * BST from storing key prefixes in the nodes, so that every step compares the full keys.
+     */
+    struct String_compare {
+	bool operator()(const std::string& a, const std::string& b) const noexcept {return a.compare(b) < 0;}
+    };
+
+    /**
+     * Functions reading a key or a value for the checksums of the types suite.
+     */
+    size_t touch(const size_t x) noexcept {return x;}
+    size_t touch(const std::string& x) noexcept {return x.size();}
+    size_t touch(const Tenant_key& x) noexcept {return x.tenant ^ x.timestamp;}
+    size_t touch(const Fat_value& x) noexcept {return x.bytes[0];}
+
+    /**
+     * Benchmark a BST and an std::map of the given key, value and comparison types, and add
+     * their records: time per insert when building from keys (with the insertion throughput),
+     * find on present keys, in-order iteration per element, and balance per element (BST only).
+     * @param types name of the types, appended to the structure names
+     * @param keys distinct keys, in order of insertion
+     * @param value function object returning the value of a key
+     */
+    template <class K, class V, class Comp, class F>
+    void types_case(const Options& options, const std::string& types, const std::vector<K>& keys, F value,
+		    std::mt19937_64& generator, Report& report) {
+
+	const size_t size{keys.size()};
+	std::vector<V> values;
+	values.reserve(size);
+	for (const K& key : keys)
+	    values.push_back(value(key));
+	std::vector<size_t> hits(size);
+	for (size_t i{0}; i < size; ++i)
+	    hits[i] = i;
+	std::shuffle(hits.begin(), hits.end(), generator);
+
+	auto run = [&](const std::string& structure, auto& tree, auto insert) {
+	    Record build{"types", structure + types, "insert", size, {}};
+	    const double per_insert{BST_benchmark::run_once(size, [&]() {
+		for (size_t i{0}; i < size; ++i)
+		    insert(tree, keys[i], values[i]);
+	    }, &build.counts)};
+	    build.stats = BST_benchmark::summarize({per_insert});
+	    build.throughput = 1e9 / per_insert;
+	    report.add(build);
+	    report.add(measure(options, "types", structure + types, "find", size, [&](size_t i) {
+		auto it = tree.find(keys[hits[i % size]]);
+		return it == tree.end() ? 0 : touch((*it).second);
+	    }));
+	    Record iterate{"types", structure + types, "iterate", size, {}};
+	    iterate.stats = time_scans(options, size, [&tree]() {
+		size_t sum{0};
+		for (const auto& x : tree)
+		    sum += touch(x.first) + touch(x.second);
+		return sum;
+	    }, iterate.counts);
+	    report.add(iterate);
+	};
+
+	{
+	    BST<K, V, Comp> bst{};
+	    run("bst", bst, [](BST<K, V, Comp>& t, const K& k, const V& v) { t.insert(k, v); });
+	    Record balance{"types", "bst" + types, "balance", size, {}};
+	    balance.stats = BST_benchmark::summarize({BST_benchmark::run_once(size, [&bst]() { bst.balance(); }, &balance.counts)});
+	    report.add(balance);
+	    report.add(measure(options, "types", "bst" + types, "find_balanced", size, [&](size_t i) {
+		auto it = bst.find(keys[hits[i % size]]);
+		return it == bst.end() ? 0 : touch((*it).second);
+	    }));
+	}
+	{
+	    std::map<K, V, Comp> map{};
+	    run("map", map, [](std::map<K, V, Comp>& t, const K& k, const V& v) { t.emplace(k, v); });
+	}
+    }
+
+    /**
+     * Types suite: for each size, BSTs and std::maps are benchmarked over a matrix of key, value
+     * and comparison types, showing how the cost of comparisons and the size of the nodes affect
+     * insert, find, iteration and balance. Keys are random 64 bits integers, URLs sharing a
+     * 37 characters prefix (compared with std::less, which lets the BST store key prefixes in
+     * the nodes, and with an equivalent comparison which does not), and (tenant, timestamp)
+     * pairs over 1000 tenants; values are short strings, 64 bits integers and 256 bytes structs.
+     */
+    void types_suite(const Options& options, Report& report) {
+
+	std::mt19937_64 generator{options.seed};
+	for (const size_t size : options.sizes()) {
+
+	    std::vector<size_t> numbers;
+	    std::unordered_map<size_t, bool> seen;
+	    while (numbers.size() < size) {
+		const size_t n{generator()};
+		if (seen.emplace(n, true).second)
+		    numbers.push_back(n);
+	    }
+	    seen.clear();
+	    std::vector<std::string> urls;
+	    std::vector<Tenant_key> tenants;
+	    for (const size_t n : numbers) {
+		urls.push_back("https://www.example.com/catalog/item/" + std::to_string(n));
+		tenants.push_back({static_cast<std::uint32_t>(n % 1000), n / 1000}); //distinct since the numbers are
+	    }
+	    auto fat = [](const auto& k) {
+		Fat_value v;
+		std::fill(std::begin(v.bytes), std::end(v.bytes), static_cast<unsigned char>(touch(k)));
+		return v;
+	    };
+
+	    types_case<size_t, std::string, std::less<size_t>>(options, "<u64,str>", numbers,
+		[](size_t k) { return std::to_string(k % 1000000); }, generator, report);
+	    types_case<size_t, Fat_value, std::less<size_t>>(options, "<u64,pod256>", numbers, fat, generator, report);
+	    types_case<std::string, size_t, std::less<std::string>>(options, "<url,u64>", urls,
+		[](const std::string& k) { return k.size(); }, generator, report);
+	    types_case<std::string, size_t, String_compare>(options, "<url,u64,compare>", urls,
+		[](const std::string& k) { return k.size(); }, generator, report);
+	    types_case<Tenant_key, size_t, std::less<Tenant_key>>(options, "<tenant_ts,u64>", tenants,
+		[](const Tenant_key& k) { return k.timestamp; }, generator, report);
+	    types_case<Tenant_key, Fat_value, std::less<Tenant_key>>(options, "<tenant_ts,pod256>", tenants, fat, generator, report);
+	}
+    }
+
+    /**
+     * Pages suite: for each size, a BST of random keys is built with its nodes allocated one by
+     * one on the heap, then carved out of regions of small pages, then of regions backed by
+     * transparent huge pages (see BST_storage). For each mode the suite reports the time per
+     * insert, the memory backed by huge pages after building the tree, and find on present keys
+     * before and after balance, along with the hardware counters (among which dTLB misses).
+     */
+    void pages_suite(const Options& options, Report& report) {
+
+	const std::pair<BST_storage::mode, std::string> modes[]{
+	    {BST_storage::mode::heap, "bst/heap"}, {BST_storage::mode::pages, "bst/pages"}, {BST_storage::mode::huge_pages, "bst/huge_pages"}};
+	std::mt19937_64 generator{options.seed};
+
+	for (const size_t size : options.sizes()) {
+
+	    std::vector<size_t> keys;
+	    std::unordered_map<size_t, bool> seen;
+	    while (keys.size() < size) {
+		const size_t n{generator()};
+		if (seen.emplace(n, true).second)
+		    keys.push_back(n);
+	    }
+	    seen.clear();
+	    std::vector<size_t> hits{keys};
+	    std::shuffle(hits.begin(), hits.end(), generator);
+
+	    for (const auto& mode : modes) {
+		if (!BST_storage::set_mode(mode.first)) {
+		    std::cerr << "node storage " << mode.second << " is not available, skipped" << std::endl;
+		    continue;
+		}
+		const std::string& structure{mode.second};
+		const size_t huge_before{BST_benchmark::huge_page_bytes()};
+		BST<size_t, size_t> bst{};
+		Record insert{"pages", structure, "insert", size, {}};
+		const double per_insert{BST_benchmark::run_once(size, [&]() {
+		    for (const size_t key : keys)
+			bst.insert(key, key);
+		}, &insert.counts)};
+		insert.stats = BST_benchmark::summarize({per_insert});
+		insert.throughput = 1e9 / per_insert;
+		report.add(insert);
+		const size_t huge_after{BST_benchmark::huge_page_bytes()};
+		Record huge{"pages", structure, "huge_pages", size,
+			    BST_benchmark::summarize({static_cast<double>(huge_after - std::min(huge_before, huge_after)) / (1 << 20)})};
+		huge.unit = "MB";
+		report.add(huge);
+
+		auto find_hit = [&](size_t i) { return bst.find(hits[i % size]) != bst.end(); };
+		report.add(measure(options, "pages", structure, "find", size, find_hit));
+		bst.balance();
+		report.add(measure(options, "pages", structure, "find_balanced", size, find_hit));
+	    }
+	    BST_storage::set_mode(BST_storage::mode::heap);
+	}
+    }
+
+    /**
+     * Build trees of the given type holding entries pairs each, size pairs in total, and add
+     * the records of the build and of find on present keys of random trees.
+     * @param structure name of the structure, followed in the records by the pairs per tree
+     * @param keys the keys of each tree, inserted in a different rotation in each tree
+     * @param insert function object inserting a key and a value in a tree
+     */
+    template <class Tree, class F>
+    void small_case(const Options& options, const std::string& structure, const size_t size, const std::vector<std::string>& keys,
+		    std::mt19937_64& generator, F insert, Report& report) {
+
+	const size_t entries{keys.size()}, count{std::max(size_t{1}, size / keys.size())};
+	const std::string name{structure + "/" + std::to_string(entries)};
+	auto record = [&](const std::string& metric, const double x, const std::string& unit) {
+	    Record r{"small", name, metric, size, BST_benchmark::summarize({x})};
+	    r.unit = unit;
+	    report.add(r);
+	};
+	BST_benchmark::release_memory();
+	const size_t bytes{BST_benchmark::heap_bytes.load()}, allocations{BST_benchmark::heap_allocations.load()};
+	std::vector<Tree> trees(count);
+	Record build{"small", name, "build", size, {}};
+	const double per_insert{BST_benchmark::run_once(count * entries, [&]() {
+	    for (size_t t{0}; t < count; ++t)
+		for (size_t j{0}; j < entries; ++j)
+		    insert(trees[t], keys[(t + j) % entries], t + j);
+	}, &build.counts)};
+	build.stats = BST_benchmark::summarize({per_insert});
+	build.throughput = 1e9 / per_insert;
+	report.add(build);
+	record("allocs_insert", static_cast<double>(BST_benchmark::heap_allocations.load() - allocations - 1) / (count * entries), "allocs/op");
+	record("heap", static_cast<double>(BST_benchmark::heap_bytes.load() - bytes) / (count * entries), "B/elem");
+
+	std::vector<std::pair<size_t, size_t>> hits(size);
+	for (auto& hit : hits)
+	    hit = {generator() % count, generator() % entries};
+	report.add(measure(options, "small", name, "find", size, [&](size_t i) {
+	    const auto& hit = hits[i % size];
+	    auto it = trees[hit.first].find(keys[hit.second]);
+	    return it == trees[hit.first].end() ? 0 : (*it).second;
+	}));
+    }
+
+    /**
+     * Small suite: for each size, that many pairs are spread over trees of 4 and of 16 pairs
+     * each, keyed by short strings, as per-user maps of attributes would be. BSTs are benchmarked
+     * with their nodes on the heap and stored inline (up to 16 pairs), along with std::maps; the
+     * suite reports the time per insert while building all the trees, the allocations per insert,
+     * the heap bytes per pair (the trees themselves included) and find on random trees.
+     */
+    void small_suite(const Options& options, Report& report) {
+
+	std::mt19937_64 generator{options.seed};
+	for (const size_t size : options.sizes()) {
+	    for (const size_t entries : {size_t{4}, size_t{16}}) {
+		std::vector<std::string> keys;
+		for (size_t j{0}; j < entries; ++j)
+		    keys.push_back("attribute:" + std::to_string(j));
+		std::shuffle(keys.begin(), keys.end(), generator);
+		using inline_type = BST<std::string, size_t, std::less<std::string>, 16>;
+		small_case<BST<std::string, size_t>>(options, "bst", size, keys, generator,
+		    [](BST<std::string, size_t>& t, const std::string& k, size_t v) { t.insert(k, v); }, report);
+		small_case<inline_type>(options, "bst_inline16", size, keys, generator,
+		    [](inline_type& t, const std::string& k, size_t v) { t.insert(k, v); }, report);
+		small_case<std::map<std::string, size_t>>(options, "map", size, keys, generator,
+		    [](std::map<std::string, size_t>& t, const std::string& k, size_t v) { t.emplace(k, v); }, report);
+	    }
+	}
+    }
+
+    /**
+     * Dense suite: for each size, a BST<u32,u64> is built from nearly contiguous keys, one in
+     * ten keys of the range being left out, inserted in random order. find is timed on present
+     * keys (hit) and on the missing ones (miss), and full in-order scans through visit_inorder,
+     * on the tree as built, after balance, and with the direct-addressed array enabled, against
+     * std::map. The suite also reports the bytes per element taken by the array.
+     */
+    void dense_suite(const Options& options, Report& report) {
+
+	std::mt19937_64 generator{options.seed};
+	for (const size_t size : options.sizes()) {
+
+	    std::vector<std::uint32_t> keys, holes;
+	    for (std::uint32_t key{0}; keys.size() < size; ++key)
+		(key % 10 == 7 ? holes : keys).push_back(key);
+	    std::shuffle(keys.begin(), keys.end(), generator);
+	    std::vector<std::uint32_t> hits{keys};
+	    std::shuffle(hits.begin(), hits.end(), generator);
+	    std::shuffle(holes.begin(), holes.end(), generator);
+
+	    auto run = [&](const std::string& structure, const auto& tree, auto scan) {
+		report.add(measure(options, "dense", structure, "hit", size, [&](size_t i) { return tree.find(hits[i % size]) != tree.end(); }));
+		report.add(measure(options, "dense", structure, "miss", size, [&](size_t i) {
+		    return tree.find(holes[i % holes.size()]) != tree.end();
+		}));
+		Record record{"dense", structure, "scan", size, {}};
+		record.stats = time_scans(options, size, [&]() { return scan(tree); }, record.counts);
+		report.add(record);
+	    };
+	    auto visit_scan = [](const BST<std::uint32_t, std::uint64_t>& tree) {
+		std::uint64_t sum{0};
+		tree.visit_inorder([&sum](const std::pair<const std::uint32_t, std::uint64_t>& x) { sum += x.second; });
+		return sum;
+	    };
+
+	    BST<std::uint32_t, std::uint64_t> bst{};
+	    for (const auto key : keys)
+		bst.insert(key, key);
+	    run("bst", bst, visit_scan);
+	    bst.balance();
+	    run("bst_balanced", bst, visit_scan);
+	    bst.enable_dense();
+	    run("bst_dense", bst, visit_scan);
+	    Record memory{"dense", "bst_dense", "array", size, BST_benchmark::summarize({static_cast<double>(bst.dense_memory()) / size})};
+	    memory.unit = "B/elem";
+	    report.add(memory);
+
+	    std::map<std::uint32_t, std::uint64_t> map{};
+	    for (const auto key : keys)
+		map.emplace(key, key);
+	    run("map", map, [](const std::map<std::uint32_t, std::uint64_t>& m) {
+		std::uint64_t sum{0};
+		for (const auto& x : m)
+		    sum += x.second;
+		return sum;
+	    });
+	}
+    }
+
+    //!Available suites, selected through --suite
+    const std::map<std::string, suite_type> suites{
+	{"lookup", lookup_suite},
+	{"ycsb", ycsb_suite},
+	{"memory", memory_suite},
+	{"orders", orders_suite},
+	{"types", types_suite},
+	{"pages", pages_suite},
+	{"small", small_suite},
+	{"dense", dense_suite},
+    };
 }
 
+
+int main(int argc, char* argv[]){
+#ifdef __BST_DEV__
+    (void)argc;
+    (void)argv;
+    BST_testing::Tester t;
+    return t.test() ? 0 : 1; //a failed test fails the bst_test target
+#else
+    Options options{};
+    try {
+	options = Options::parse(argc, argv);
+    }
+    catch (const std::exception& e) {
+	std::cerr << e.what() << " (see --help)" << std::endl;
+	return 1;
+    }
+    auto suite = suites.find(options.suite);
+    if (suite == suites.end()) {
+	std::cerr << "unknown suite " << options.suite << std::endl;
+	return 1;
+    }
+
+    std::cout << "seed " << options.seed << ", " << options.repetitions << " batches of " << options.batch
+	      << " operations after " << options.warmup << " warmup batches" << std::endl;
+    BST_benchmark::Counters::instance().enable(options.counters);
+    if (options.counters)
+	std::cout << "hardware counters: " << BST_benchmark::Counters::instance().status() << std::endl;
+    Report report{};
+    Report::print_header();
+    suite->second(options, report);
+    report.save(options);
+#endif
+
+}
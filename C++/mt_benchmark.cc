@@ -0,0 +1,251 @@
+#include "BST.h"
+#include "BST_benchmark.h"
+#include <string>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+
+
+namespace {
+
+    using bst_type = BST<size_t, size_t>;
+    using BST_benchmark::Options;
+    using BST_benchmark::Report;
+    using BST_benchmark::Record;
+
+    /**
+     * A workload, given by the fraction of its operations which are inserts of new keys, the
+     * others being lookups of keys in the tree.
+     */
+    struct Workload {
+	std::string name;
+	double inserts;
+    };
+    const Workload workloads[]{{"read_only", 0}, {"read_mostly", 0.05}, {"write_heavy", 0.5}};
+
+    /**
+     * Ways the threads access the trees: each one its own copy, all of them a single tree through
+     * a const reference (lookups only), through an std::mutex, or through an std::shared_mutex
+     * taken in shared mode by lookups and in exclusive mode by inserts.
+     */
+    const std::string modes[]{"copies", "shared_const", "mutex", "rwlock"};
+
+    //!One operation of a thread
+    struct Request {
+	bool insert;
+	size_t key;
+    };
+
+    /**
+     * Return the numbers of threads to run with: the powers of two below the largest one, and the
+     * largest one.
+     */
+    std::vector<size_t> thread_counts(const Options& options) {
+	const size_t largest{options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency())};
+	std::vector<size_t> counts;
+	for (size_t t{1}; t < largest; t <<= 1)
+	    counts.push_back(t);
+	counts.push_back(largest);
+	return counts;
+    }
+
+    /**
+     * Run op on the given number of threads, each running its warmup batches and then timing its
+     * own batches as run_batches does, and return a record summarizing the samples of all the
+     * threads. Threads start the warmup together and the measured batches together; the throughput
+     * is the number of measured operations over the wall time from that common start to the end
+     * of the last thread, so that it does not count threads time-slicing the same core as parallel.
+     * @param op function object called with the index of the thread and the index of the operation
+     */
+    template <class F>
+    Record run_threads(const Options& options, const size_t threads, const std::string& mode,
+		       const std::string& workload, const size_t size, F op) {
+
+	using clock = std::chrono::steady_clock;
+	std::vector<std::vector<double>> samples(threads);
+	std::vector<clock::time_point> starts(threads), ends(threads);
+	std::vector<size_t> accumulators(threads); //added into sink once the threads joined
+	std::atomic<size_t> arrived{0};
+	auto barrier = [&arrived, threads](const size_t phase) { //wait for all the threads to reach the given phase
+	    arrived.fetch_add(1);
+	    while (arrived.load() < threads * phase)
+		std::this_thread::yield();
+	};
+
+	std::vector<std::thread> pool;
+	for (size_t t{0}; t < threads; ++t)
+	    pool.emplace_back([&, t]() {
+		size_t i{0}, accumulator{0};
+		barrier(1);
+		for (size_t b{0}; b < options.warmup * options.batch; ++b)
+		    accumulator += op(t, i++);
+		barrier(2);
+		starts[t] = clock::now();
+		for (size_t b{0}; b < options.repetitions; ++b) {
+		    const auto begin = clock::now();
+		    for (size_t j{0}; j < options.batch; ++j)
+			accumulator += op(t, i++);
+		    const auto end = clock::now();
+		    samples[t].push_back(std::chrono::duration<double, std::nano>(end - begin).count() / options.batch);
+		}
+		ends[t] = clock::now();
+		accumulators[t] = accumulator;
+	    });
+	for (auto& thread : pool)
+	    thread.join();
+	for (const size_t accumulator : accumulators)
+	    BST_benchmark::sink = BST_benchmark::sink + accumulator;
+
+	std::vector<double> all;
+	for (const auto& s : samples)
+	    all.insert(all.end(), s.begin(), s.end());
+	const double elapsed{std::chrono::duration<double>(*std::max_element(ends.begin(), ends.end()) - *std::min_element(starts.begin(), starts.end())).count()};
+	Record record{"mt", mode, workload + "/" + std::to_string(threads), size, BST_benchmark::summarize(all)};
+	record.throughput = threads * options.repetitions * options.batch / elapsed;
+	return record;
+    }
+
+    /**
+     * Scaling suite: for each size, a balanced tree of random even keys is built, and each
+     * workload is run in each mode by 1 to N threads. Lookups look for keys in the tree, inserts
+     * add random odd keys. Trees are copied afresh from the initial one for every run, so that
+     * inserts of previous runs do not add up.
+     */
+    void scaling_suite(const Options& options, Report& report) {
+
+	const size_t ops{(options.warmup + options.repetitions) * options.batch};
+	std::map<std::string, std::vector<std::pair<size_t, double>>> curves;
+
+	for (const size_t size : options.sizes()) {
+
+	    std::mt19937_64 generator{options.seed};
+	    std::uniform_int_distribution<size_t> rand{0, ~size_t{0} >> 1};
+	    bst_type initial{};
+	    std::vector<size_t> keys;
+	    while (initial.size() < size) {
+		const size_t key{rand(generator) << 1};
+		initial.insert(key, key);
+		keys.push_back(key);
+	    }
+	    initial.balance();
+	    const std::vector<size_t> counts{thread_counts(options)};
+
+	    for (const Workload& workload : workloads) {
+
+		std::vector<std::vector<Request>> requests(counts.back()); //one sequence per thread
+		std::uniform_real_distribution<double> coin{0, 1};
+		for (auto& sequence : requests)
+		    for (size_t i{0}; i < ops; ++i) {
+			if (coin(generator) < workload.inserts)
+			    sequence.push_back({true, (rand(generator) << 1) | 1});
+			else
+			    sequence.push_back({false, keys[generator() % keys.size()]});
+		    }
+
+		for (const std::string& mode : modes) {
+		    if (mode == "shared_const" && workload.inserts > 0)
+			continue;
+		    for (const size_t threads : counts) {
+
+			Record record;
+			if (mode == "copies") {
+			    std::vector<bst_type> copies(threads, initial);
+			    record = run_threads(options, threads, mode, workload.name, size, [&](size_t t, size_t i) -> size_t {
+				const Request& r{requests[t][i]};
+				if (r.insert) {
+				    copies[t].insert(r.key, r.key);
+				    return 0;
+				}
+				return copies[t].find(r.key) != copies[t].end();
+			    });
+			}
+			else if (mode == "shared_const") {
+			    const bst_type& tree{initial};
+			    record = run_threads(options, threads, mode, workload.name, size, [&](size_t t, size_t i) -> size_t {
+				return tree.find(requests[t][i].key) != tree.end();
+			    });
+			}
+			else if (mode == "mutex") {
+			    bst_type tree{initial};
+			    std::mutex lock;
+			    record = run_threads(options, threads, mode, workload.name, size, [&](size_t t, size_t i) -> size_t {
+				const Request& r{requests[t][i]};
+				std::lock_guard<std::mutex> guard{lock};
+				if (r.insert) {
+				    tree.insert(r.key, r.key);
+				    return 0;
+				}
+				return tree.find(r.key) != tree.end();
+			    });
+			}
+			else {
+			    bst_type tree{initial};
+			    std::shared_mutex lock;
+			    record = run_threads(options, threads, mode, workload.name, size, [&](size_t t, size_t i) -> size_t {
+				const Request& r{requests[t][i]};
+				if (r.insert) {
+				    std::unique_lock<std::shared_mutex> guard{lock};
+				    tree.insert(r.key, r.key);
+				    return 0;
+				}
+				std::shared_lock<std::shared_mutex> guard{lock};
+				return tree.find(r.key) != tree.end();
+			    });
+			}
+			curves[mode + " " + workload.name + " " + std::to_string(size)].push_back({threads, record.throughput});
+			report.add(record);
+		    }
+		}
+	    }
+	}
+
+	std::cout << "\nScaling curves: throughput in Mops/s by number of threads (speedup over one thread)" << std::endl;
+	for (const auto& curve : curves) {
+	    std::cout << std::left << std::setw(36) << curve.first << std::right << std::fixed;
+	    for (const auto& point : curve.second)
+		std::cout << "  " << point.first << ": " << std::setprecision(2) << point.second / 1e6
+			  << " (" << std::setprecision(2) << point.second / curve.second.front().second << "x)";
+	    std::cout << std::endl;
+	}
+    }
+}
+
+
+int main(int argc, char* argv[]){
+
+    Options defaults{};
+    defaults.base = 10;
+    defaults.min_exp = defaults.max_exp = 6;
+    defaults.warmup = 10;
+    defaults.repetitions = 200;
+    defaults.suite = "scaling";
+    Options options{};
+    try {
+	options = Options::parse(argc, argv, defaults);
+    }
+    catch (const std::exception& e) {
+	std::cerr << e.what() << " (see --help)" << std::endl;
+	return 1;
+    }
+    if (options.suite != "scaling") {
+	std::cerr << "unknown suite " << options.suite << std::endl;
+	return 1;
+    }
+
+    std::cout << "seed " << options.seed << ", " << options.repetitions << " batches of " << options.batch
+	      << " operations per thread after " << options.warmup << " warmup batches, up to "
+	      << thread_counts(options).back() << " threads" << std::endl;
+    Report report{};
+    Report::print_header();
+    scaling_suite(options, report);
+    report.save(options);
+
+}
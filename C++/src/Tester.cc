@@ -1,7 +1,55 @@
 #include "BST.h"
+#include "BST_frozen.h"
+#include "BST_benchmark.h"
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <random>
+#include <atomic>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <map>
+
+namespace {
+
+    /**
+     * Key counting its copies, and comparison counting its calls, to check that the BST does
+     * not copy keys while moving down the tree and compares them a bounded number of times.
+     */
+    struct counted_key {
+        int value;
+        inline static size_t copies{0};
+        counted_key(const int v) : value{v} {}
+        counted_key(const counted_key& other) : value{other.value} {++copies;}
+        counted_key& operator=(const counted_key& other) {value = other.value; ++copies; return *this;}
+    };
+
+    struct counting_less {
+        inline static size_t calls{0};
+        bool operator()(const counted_key& a, const counted_key& b) const {++calls; return a.value < b.value;}
+    };
+
+    /**
+     * Value whose copy throws once a given number of copies has been made.
+     */
+    struct fragile_value {
+        inline static int copies_left{-1};
+        int value{0};
+        fragile_value() = default;
+        fragile_value(const int v) : value{v} {}
+        fragile_value(const fragile_value& other) : value{other.value} {
+            if (copies_left == 0)
+                throw std::runtime_error{"copy failed"};
+            if (copies_left > 0)
+                --copies_left;
+        }
+        fragile_value& operator=(const fragile_value& other) = default;
+    };
+}
 
 namespace BST_testing{
 
@@ -12,19 +60,41 @@ namespace BST_testing{
         return pairs;
     }
 
-    void Tester::test() const {
+    bool Tester::test() const {
 
-	bst_default_ctor();
-	bst_insert();
+	bool passed{bst_default_ctor()};    //every test runs, whatever the outcome of the previous ones
+	passed = bst_insert() && passed;
 	if (bst_copy_ctor()) {
-	    bst_deep_copy();
-        }
-	bst_move_ctor();
-	test_move_copy_assignment();
-	test_iterator();
-	test_find();
-	bst_balance();
-        test_clear();
+	    passed = bst_deep_copy() && passed;
+        }
+	else
+	    passed = false;
+        passed = bst_move_ctor() && passed;
+        passed = test_move_copy_assignment() && passed;
+        passed = test_iterator() && passed;
+        passed = test_find() && passed;
+        passed = bst_balance() && passed;
+        passed = test_clear() && passed;
+        passed = test_deep_tree() && passed;
+        passed = test_parallel() && passed;
+        passed = test_range() && passed;
+        passed = test_visit() && passed;
+        passed = test_cursor() && passed;
+        passed = test_export_columns() && passed;
+        passed = test_index() && passed;
+        passed = test_filter() && passed;
+        passed = test_frozen() && passed;
+        passed = test_key_prefix() && passed;
+        passed = test_height() && passed;
+        passed = test_stats() && passed;
+        passed = test_rebalance() && passed;
+        passed = test_latency() && passed;
+        passed = test_complexity() && passed;
+        passed = test_storage() && passed;
+        passed = test_compact() && passed;
+        passed = test_inline() && passed;
+        passed = test_dense() && passed;
+        return passed;
     }
 
     bool Tester::bst_default_ctor() const noexcept {
@@ -231,6 +301,12 @@ namespace BST_testing{
         }
         std::cerr << "move test " << (result ?  "passed" : "failed") << std::endl;
 
+        bst_type& alias{_move};    //assigning a tree to itself leaves it untouched
+        _move = std::move(alias);
+        copy = static_cast<const bst_type&>(copy);
+        result = result && _move.size() == pairs.size() && copy.size() == pairs.size() && _move[14] == "14" && copy[14] == "14";
+        std::cerr << "self assignment test " << (result ?  "passed" : "failed") << std::endl;
+
         std::cerr << "overall test " << (result ?  "passed" : "failed") << std::endl;
         return result;
     }
@@ -310,4 +386,996 @@ namespace BST_testing{
         std::cerr << "test clear " << (result ?  "passed" : "failed") << std::endl;
         return result;
     }
+
+    bool Tester::test_deep_tree() const {
+
+        std::cout << "** Testing copy and clear of degenerate trees **" << std::endl;
+        const int size{1000000};    //deep enough to overflow the stack if nodes were freed recursively
+        bst_type bst{};
+        bst.root.reset(new bst_type::node_type{0, "0", nullptr});
+        bst_type::node_type* last{bst.root.get()};
+        for (int i{1}; i < size; ++i) {    //link the nodes by hand, as inserting sorted keys is quadratic
+            last->right_child.reset(new bst_type::node_type{i, std::to_string(i), last});
+            last = last->right_child.get();
+        }
+        bst.node_count = size;
+
+        bst_type copy{bst};
+        bool result{true};
+        int count{0};
+        for (auto& x : copy) {    //check the copy has the same pairs, in the same order
+            result = result && x.first == count && x.second == std::to_string(count);
+            ++count;
+        }
+        result = result && count == size;
+        std::cerr << "deep copy test " << (result ? "passed" : "failed") << std::endl;
+
+        copy.clear();
+        result = result && copy.root == nullptr;
+        std::cerr << "deep clear test " << (result ? "passed" : "failed") << std::endl;
+        return result;    //bst is destroyed here, through the same iterative teardown
+    }
+
+    bool Tester::test_parallel() const {
+
+        std::cout << "** Testing for_each and transform_reduce **" << std::endl;
+        bst_type bst{};
+        std::mt19937 generator{42};
+        std::uniform_int_distribution<int> rand{0, 1000000};
+        long expected{0};
+        for (int i{0}; i < 100000; ++i) {
+            int num{rand(generator)};
+            if (bst.find(num) == bst.end()) expected += num;
+            bst.insert(num, std::to_string(num));
+        }
+        BST_execution::parallel_policy four{4};
+        auto add = [](long a, long b) { return a + b; };
+        auto key = [](const bst_type::pair_type& x) { return long{x.first}; };
+
+        bool result{bst.transform_reduce(BST_execution::seq, 0L, add, key) == expected};
+        result = result && bst.transform_reduce(four, 0L, add, key) == expected;
+        result = result && bst.transform_reduce(BST_execution::par, 0L, add, key) == expected;
+        std::cerr << "transform_reduce test " << (result ? "passed" : "failed") << std::endl;
+
+        std::atomic<long> sum{0};
+        bst.for_each(four, [](bst_type::pair_type& x) { x.second += "!"; });    //every value must be visited exactly once
+        const bst_type& const_bst{bst};
+        const_bst.for_each(four, [&sum](const bst_type::pair_type& x) { sum += x.first; });
+        result = result && sum == expected;
+        for (auto& x : bst)
+            result = result && x.second == std::to_string(x.first) + "!";
+        std::cerr << "for_each test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type empty{};    //check degenerate inputs do not spawn work on missing nodes
+        result = result && empty.transform_reduce(four, 7L, add, key) == 7;
+        std::cerr << "empty tree test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type small{};    //below the cutoff the calling thread does all the work
+        for (int i{0}; i < 1000; ++i) small.insert(i, std::to_string(i));
+        bool caller{true};
+        std::vector<std::thread::id> ids;
+        std::mutex lock;
+        small.for_each(four, [&](bst_type::pair_type&) { std::lock_guard<std::mutex> guard{lock}; ids.push_back(std::this_thread::get_id()); });
+        for (const auto& id : ids) caller = caller && id == std::this_thread::get_id();
+        result = result && caller && ids.size() == 1000 && small.transform_reduce(four, 0L, add, key) == 499500;
+        const BST_execution::parallel_policy forced{4, 0};    //a cutoff of 0 splits even small trees
+        result = result && small.transform_reduce(forced, 0L, add, key) == 499500;
+        std::cerr << "sequential cutoff test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_range() const {
+
+        std::cout << "** Testing splittable ranges **" << std::endl;
+        bst_type bst{};
+        auto pairs{init_test()};
+        for (auto& x : pairs) bst.insert(x);
+
+        auto r = bst.range(3, 13);    //holds 3, 4, 6, 7, 8, 10
+        bool result{r.is_divisible() && !r.empty()};
+        auto upper = r.split();
+        std::vector<int> keys;
+        for (auto it = r.begin(); it != r.end(); ++it) keys.push_back((*it).first);
+        const size_t lower_size{keys.size()};
+        for (auto it = upper.begin(); it != upper.end(); ++it) keys.push_back((*it).first);
+        result = result && keys == std::vector<int>{3, 4, 6, 7, 8, 10};    //halves are disjoint, ordered and cover the range
+        result = result && lower_size > 0 && lower_size < keys.size();
+        result = result && bst.range(13, 3).empty() && bst.range(15, 20).empty();
+        result = result && !bst.range(6, 7).is_divisible() && !bst.range(3, 13, 6).is_divisible();
+        std::cerr << "split test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type big{};
+        std::mt19937 generator{7};
+        std::uniform_int_distribution<int> rand{0, 1000000};
+        for (int i{0}; i < 100000; ++i) {
+            int num{rand(generator)};
+            big.insert(num, std::to_string(num));
+        }
+        long expected{0}, seq_sum{0};
+        std::atomic<long> par_sum{0};
+        for (auto& x : big)
+            if (x.first >= 250000 && x.first < 750000) expected += x.first;
+        big.for_each(BST_execution::seq, big.range(250000, 750000), [&seq_sum](bst_type::pair_type& x) { seq_sum += x.first; });
+        big.for_each(BST_execution::parallel_policy{4}, big.range(250000, 750000, 64), [&par_sum](bst_type::pair_type& x) { par_sum += x.first; });
+        result = result && seq_sum == expected && par_sum == expected;
+        std::cerr << "parallel scan test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_visit() const {
+
+        std::cout << "** Testing visit_inorder and visit_range **" << std::endl;
+        bst_type bst{};
+        auto pairs{init_test()};
+        for (auto& x : pairs) bst.insert(x);
+
+        std::vector<std::pair<int,std::string>> visited;
+        bst.visit_inorder([&visited](bst_type::pair_type& x) { visited.push_back(x); });
+        bool result{visited == pairs};    //visit is indeed the in-order one
+        std::cerr << "visit_inorder test " << (result ? "passed" : "failed") << std::endl;
+
+        const bst_type& const_bst{bst};
+        std::vector<int> keys;
+        const_bst.visit_range(3, 13, [&keys](const bst_type::pair_type& x) { keys.push_back(x.first); });
+        result = result && keys == std::vector<int>{3, 4, 6, 7, 8, 10};
+        keys.clear();
+        bst.visit_range(5, 9, [&keys](bst_type::pair_type& x) { keys.push_back(x.first); });    //bounds not in the tree
+        result = result && keys == std::vector<int>{6, 7, 8};
+        keys.clear();
+        bst.visit_range(9, 5, [&keys](bst_type::pair_type& x) { keys.push_back(x.first); });
+        result = result && keys.empty();
+        bst.visit_range(100, 200, [&keys](bst_type::pair_type& x) { keys.push_back(x.first); });    //every key below lo
+        result = result && keys.empty();
+        bst.visit_range(200, 100, [&keys](bst_type::pair_type& x) { keys.push_back(x.first); });    //lo > hi, both above every key
+        result = result && keys.empty();
+        std::cerr << "visit_range test " << (result ? "passed" : "failed") << std::endl;
+
+        std::ostringstream printed, expected;
+        printed << bst;
+        for (auto& x : pairs) expected << x.first << ": " << x.second << std::endl;
+        result = result && printed.str() == expected.str();
+        std::cerr << "operator<< test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_cursor() const {
+
+        std::cout << "** Testing batch cursors **" << std::endl;
+        bst_type bst{};
+        auto pairs{init_test()};
+        for (auto& x : pairs) bst.insert(x);
+
+        std::vector<std::pair<int,std::string>> exported;
+        bst_type::cursor_type::entry_type buffer[4];
+        auto cursor = bst.cursor();
+        size_t count{cursor.next(buffer, 4)};    //first batch, then save the position and drop the cursor
+        for (size_t i{0}; i < count; ++i) exported.push_back({*buffer[i].first, *buffer[i].second});
+        bool result{count == 4 && cursor.position() && *cursor.position() == 7};
+        int saved{*cursor.position()};
+
+        auto resumed = bst.cursor(saved);
+        while ((count = resumed.next(buffer, 4)) > 0)
+            for (size_t i{0}; i < count; ++i) exported.push_back({*buffer[i].first, *buffer[i].second});
+        result = result && resumed.done() && resumed.position() == nullptr && exported == pairs;
+        std::cerr << "batch export test " << (result ? "passed" : "failed") << std::endl;
+
+        result = result && bst.cursor(9).next(buffer, 1) == 1 && *buffer[0].first == 10;
+        *buffer[0].second = "changed";    //values are handed out by pointer
+        result = result && bst[10] == "changed";
+        result = result && bst.cursor(15).done() && bst_type{}.cursor().done();
+        std::cerr << "cursor seek test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_export_columns() const {
+
+        std::cout << "** Testing size and export_columns **" << std::endl;
+        bst_type bst{};
+        auto pairs{init_test()};
+        bool result{bst.size() == 0};
+        for (auto& x : pairs) bst.insert(x);
+        bst.insert(8, "eight");    //updating a value does not change the size
+        result = result && bst.size() == pairs.size();
+        bst.balance();
+        bst_type copy{bst};
+        result = result && bst.size() == pairs.size() && copy.size() == pairs.size();
+        bst_type moved{std::move(copy)};
+        result = result && moved.size() == pairs.size() && copy.size() == 0;
+        moved.clear();
+        result = result && moved.size() == 0;
+        std::cerr << "size test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type big{};
+        std::mt19937 generator{11};
+        std::uniform_int_distribution<int> rand{0, 1000000};
+        for (int i{0}; i < 50000; ++i) {
+            int num{rand(generator)};
+            big.insert(num, std::to_string(num));
+        }
+        std::vector<int> expected_keys, keys, par_keys;
+        std::vector<std::string> expected_values, values, par_values;
+        for (auto& x : big) {
+            expected_keys.push_back(x.first);
+            expected_values.push_back(x.second);
+        }
+        big.export_columns(keys, values);
+        big.export_columns(BST_execution::parallel_policy{4}, par_keys, par_values);
+        result = result && keys == expected_keys && values == expected_values;
+        result = result && par_keys == expected_keys && par_values == expected_values;
+        std::cerr << "export test " << (result ? "passed" : "failed") << std::endl;
+
+        bst.export_columns(4, 10, keys, values);
+        result = result && keys == std::vector<int>{4, 6, 7, 8} && values == std::vector<std::string>{"4", "6", "7", "eight"};
+        bst.export_columns(100, 200, keys, values);    //every key below lo
+        result = result && keys.empty() && values.empty();
+        std::cerr << "range export test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_index() const {
+
+        std::cout << "** Testing hash index **" << std::endl;
+        bst_type bst{};
+        auto pairs{init_test()};
+        for (auto& x : pairs) bst.insert(x);
+        bst.enable_index();
+
+        bool result{bst.indexed() && bst.index_memory() > 0};
+        for (auto& x : pairs)    //indexed lookups find the very same nodes
+            result = result && bst.find(x.first) != bst.end() && &(*bst.find(x.first)).second == &bst[x.first];
+        result = result && bst.find(2) == bst.end() && bst.find(100) == bst.end();
+        std::cerr << "indexed find test " << (result ? "passed" : "failed") << std::endl;
+
+        bst.insert(5, "five");    //the index follows insertions, balance and updates
+        bst.balance();
+        bst[13] = "thirteen";
+        bst[20] = "twenty";
+        result = result && (*bst.find(5)).second == "five" && (*bst.find(13)).second == "thirteen" && bst.find(20) != bst.end();
+        result = result && bst.size() == pairs.size() + 2 && bst.index->find(bst.root->data.first) == bst.root.get();
+        std::vector<int> keys;
+        for (auto& x : bst) keys.push_back(x.first);
+        result = result && keys == std::vector<int>{1, 3, 4, 5, 6, 7, 8, 10, 13, 14, 20};    //iteration is still ordered
+        std::cerr << "index consistency test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type copy{bst};    //the copy indexes its own nodes
+        result = result && copy.indexed() && copy.find(5) != bst.find(5) && (*copy.find(5)).second == "five";
+        bst_type moved{std::move(copy)};
+        result = result && moved.indexed() && !copy.indexed() && moved.find(20) != moved.end();
+        moved.clear();
+        result = result && moved.find(20) == moved.end();
+        bst.disable_index();
+        result = result && !bst.indexed() && bst.index_memory() == 0 && (*bst.find(5)).second == "five";
+        std::cerr << "index copy and clear test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_filter() const {
+
+        std::cout << "** Testing membership filter **" << std::endl;
+        bst_type bst{};
+        for (int i{0}; i < 20000; i += 2) bst.insert(i, std::to_string(i));    //even keys only
+        bst.enable_filter(0.01);
+
+        bool result{bst.filter_stats().bits > 0 && bst.filter_stats().queries == 0};
+        for (int i{0}; i < 20000; i += 2)    //no false negatives
+            result = result && bst.find(i) != bst.end();
+        result = result && bst.filter_stats().rejected == 0;
+        for (int i{1}; i < 20000; i += 2)
+            result = result && bst.find(i) == bst.end();
+        auto stats = bst.filter_stats();
+        result = result && stats.queries == 20000 && stats.rejected > 9800;    //about 1% of the 10000 absent keys pass
+        std::cerr << "filter rejection test " << (result ? "passed" : "failed") << std::endl;
+
+        bst.insert(20001, "odd");    //keys added later are in the filter, and balance rebuilds it
+        result = result && bst.find(20001) != bst.end();
+        bst.balance();
+        bst_type copy{bst};
+        result = result && bst.filter_stats().bits == copy.filter_stats().bits;
+        result = result && bst.find(20001) != bst.end() && copy.find(20000) == copy.end() && copy.find(19998) != copy.end();
+        bst.clear();
+        result = result && bst.find(0) == bst.end();
+        bst.disable_filter();
+        result = result && bst.filter_stats().bits == 0;
+        std::cerr << "filter maintenance test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_frozen() const {
+
+        std::cout << "** Testing frozen snapshots **" << std::endl;
+        BST<std::string, int> bst{};
+        for (int i{0}; i < 1000; ++i)    //URL-like keys, sharing long prefixes
+            bst.insert("https://www.example.com/items/" + std::to_string(i * 7) + "/details", i);
+        bst.insert("", -1);
+        bst.insert("a", -2);
+        BST_frozen<int> frozen{bst};
+
+        bool result{frozen.size() == bst.size()};
+        auto it = frozen.begin();
+        for (auto& x : bst) {    //same pairs, in the same order
+            result = result && it != frozen.end() && (*it).first == x.first && (*it).second == x.second;
+            ++it;
+        }
+        result = result && it == frozen.end();
+        std::cerr << "frozen iteration test " << (result ? "passed" : "failed") << std::endl;
+
+        for (auto& x : bst)
+            result = result && frozen.find(x.first) != frozen.end() && (*frozen.find(x.first)).second == x.second;
+        result = result && frozen.find("https://www.example.com/items/1/details") == frozen.end();
+        result = result && frozen.find("zzz") == frozen.end() && frozen.find("https://") == frozen.end();
+        BST_frozen<int> empty{BST<std::string, int>{}};
+        result = result && empty.find("a") == empty.end() && empty.begin() == empty.end();
+        std::cerr << "frozen find test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_key_prefix() const {
+
+        std::cout << "** Testing key prefixes **" << std::endl;
+        using string_bst = BST<std::string, int>;
+        using greater_bst = BST<std::string, int, std::greater<std::string>>;
+        bool result{string_bst::prefixed && !greater_bst::prefixed && !bst_type::prefixed};
+        result = result && sizeof(greater_bst::node_type) + sizeof(std::uint64_t) == sizeof(string_bst::node_type);    //no prefix stored for other orderings
+        greater_bst greater{};
+        for (const std::string key : {"b", "abcdefgh1", "c", "abcdefgh0"}) greater.insert(key, 0);
+        std::vector<std::string> descending;
+        for (auto& x : greater) descending.push_back(x.first);
+        result = result && descending == std::vector<std::string>{"c", "b", "abcdefgh1", "abcdefgh0"};
+        string_bst bst{};
+        bst.insert("https://a", 0);
+        result = result && bst.root->key_prefix == 0x68747470733a2f2fULL;    //"https://" in big-endian
+        std::cerr << "prefix layout test " << (result ? "passed" : "failed") << std::endl;
+
+        std::vector<std::string> keys{"", "a", "ab", std::string{"ab\0", 3}, "abcdefgh", "abcdefgh0", "abcdefghz",
+                                      "abcdefg", "b", "\xff", "\xff\xff", "https://x/1", "https://x/10", "https://x/2"};
+        std::mt19937 generator{5};
+        std::shuffle(keys.begin(), keys.end(), generator);
+        for (size_t i{0}; i < keys.size(); ++i) bst.insert(keys[i], static_cast<int>(i + 1));
+        for (size_t i{0}; i < keys.size(); ++i)    //ties on prefixes fall back to the full keys
+            result = result && bst.find(keys[i]) != bst.end() && (*bst.find(keys[i])).second == static_cast<int>(i + 1);
+        result = result && bst.find("abcdefgh1") == bst.end() && bst.find(std::string{"a\0", 2}) == bst.end();
+        std::vector<std::string> sorted{keys};
+        sorted.push_back("https://a");
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<std::string> visited;
+        for (auto& x : bst) visited.push_back(x.first);
+        result = result && visited == sorted;    //order agrees with std::less, including characters above 0x7f
+        std::cerr << "prefix order test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_height() const {
+
+        std::cout << "** Testing height **" << std::endl;
+        bst_type bst{};
+        bool result{bst.height() == 0};
+        bst.insert(5, "five");
+        result = result && bst.height() == 1;
+        for (int i{0}; i < 1000; ++i) bst.insert(10 + i, "");    //sorted keys give a chain
+        result = result && bst.height() == 1001;
+        bst.balance();
+        result = result && bst.height() == 10;    //ceil(log2(1002))
+        std::cerr << "height test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_stats() const {
+
+        std::cout << "** Testing stats **" << std::endl;
+        bst_type bst{};
+        auto stats = bst.stats();
+        bool result{stats.size == 0 && stats.height == 0 && stats.leaf_depths.empty() && stats.height_ratio == 0};
+        for (int i : {4, 2, 6, 1, 3, 5, 7}) bst.insert(i, "");    //perfect tree of height 3
+        stats = bst.stats();
+        result = result && stats.size == 7 && stats.height == 3 && stats.max_depth == 2 && stats.height_ratio == 1
+                 && stats.average_depth == 10.0 / 7 && stats.leaf_depths == std::vector<size_t>{0, 0, 4};
+        for (int i{8}; i < 16; ++i) bst.insert(i, "");    //a chain of 8 below 7
+        stats = bst.stats();
+        result = result && stats.height == 11 && stats.height_ratio == 11.0 / 4
+                 && stats.leaf_depths == std::vector<size_t>{0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 1};
+        std::cerr << "shape stats test " << (result ? "passed" : "failed") << std::endl;
+
+        bst.reset_probe_stats();
+        bst.find(1);
+        bst.find(15);
+        bst.find(100);
+        bst.insert(16, "");
+        const auto probes = bst.probe_stats();
+        if constexpr (bst_type::probing) {    //going left takes one comparison, going right or finding the key two
+            result = result && probes.finds == 3 && probes.find_nodes == 3 + 11 + 11 && probes.find_comparisons == 4 + 22 + 22
+                     && probes.inserts == 1 && probes.insert_nodes == 11 && probes.insert_comparisons == 22;
+            bst.balance();
+            result = result && bst.probe_stats().inserts == 1;    //balance does not count its inserts
+        }
+        else {
+            result = result && probes.finds == 0 && probes.inserts == 0;
+        }
+        std::cerr << "probe counters test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_rebalance() const {
+
+        std::cout << "** Testing automatic rebalance **" << std::endl;
+        const size_t size{5000};
+        bst_type off{}, synchronous{}, deferred{};
+        synchronous.set_rebalance_policy({BST_rebalance::mode::synchronous, 2.0, 64});
+        deferred.set_rebalance_policy({BST_rebalance::mode::deferred, 2.0, 64});
+        bool result{true};
+        for (size_t i{0}; i < size; ++i) {    //sorted keys, the worst case
+            off.insert(static_cast<int>(i), "");
+            synchronous.insert(static_cast<int>(i), "");
+            deferred.insert(static_cast<int>(i), "");
+            result = result && synchronous.height() <= std::max(64.0, 2.0 * std::log2(i + 2.0)) + 1;
+        }
+        const auto stats = synchronous.rebalance_stats();
+        result = result && off.rebalance_stats().triggers == 0 && off.height() == size && off.rebalance_stats().height == size
+                 && stats.triggers > 0 && stats.triggers == stats.rebalances && !stats.pending
+                 && stats.height == synchronous.height() && synchronous.size() == size;
+        for (size_t i{0}; i < size; ++i)
+            result = result && synchronous.find(static_cast<int>(i)) != synchronous.end();
+        std::cerr << "synchronous rebalance test " << (result ? "passed" : "failed") << std::endl;
+
+        result = result && deferred.rebalance_stats().pending && deferred.rebalance_stats().triggers == 1
+                 && deferred.rebalance_stats().rebalances == 0 && deferred.height() == size;
+        result = result && deferred.maintain() && !deferred.maintain() && deferred.height() == 13
+                 && deferred.rebalance_stats().height == 13 && deferred.rebalance_stats().rebalances == 1;
+        off.set_rebalance_policy({BST_rebalance::mode::deferred, 2.0, 64});    //checked right away
+        result = result && off.rebalance_stats().pending;
+        bst_type moved{std::move(off)};
+        result = result && moved.maintain() && moved.height() == 13 && off.rebalance_stats().height == 0;
+        std::cerr << "deferred rebalance test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_latency() const {
+
+        std::cout << "** Testing latency histograms **" << std::endl;
+#ifdef BST_LATENCY_HISTOGRAMS
+        bool result{true};
+        for (std::uint64_t v : {0ull, 1ull, 31ull, 32ull, 63ull, 64ull, 1000ull, 123456789ull, ~0ull}) {    //buckets hold their values
+            const size_t b{BST_latency::buckets::index(v)};
+            result = result && b < BST_latency::buckets::count && BST_latency::buckets::lowest(b) <= v
+                     && (b + 1 == BST_latency::buckets::count || v < BST_latency::buckets::lowest(b + 1))
+                     && v - BST_latency::buckets::lowest(b) <= v / 32;
+        }
+        BST_latency::histogram h{};
+        for (std::uint64_t v{1}; v <= 1000; ++v)
+            h.record(v);
+        result = result && h.count() == 1000 && h.min() == 1 && h.max() == 1000 && h.mean() == 500.5
+                 && h.quantile(0.5) <= 500 && h.quantile(0.5) >= 500 - 500 / 32 && h.quantile(1) <= 1000 && h.quantile(1) >= 1000 - 1000 / 32;
+        std::cerr << "histogram buckets test " << (result ? "passed" : "failed") << std::endl;
+
+        BST_latency::reset();
+        bst_type tree{};
+        for (int i{0}; i < 100; ++i)
+            tree.insert(i, "");
+        for (int i{0}; i < 200; ++i)
+            tree.find(i);
+        tree[7] = "seven";
+        tree[1000] = "new";
+        tree.balance();
+        std::vector<std::thread> threads;    //histograms of exited threads are kept
+        for (int t{0}; t < 4; ++t)
+            threads.emplace_back([&tree]() { for (int i{0}; i < 50; ++i) tree.find(i); });
+        for (auto& thread : threads)
+            thread.join();
+        //nested calls (the find and insert of operator[], the inserts of balance) are not recorded
+        const auto snapshot = BST_latency::snapshot();
+        result = result && snapshot[0].count() == 400 && snapshot[1].count() == 100 && snapshot[2].count() == 2
+                 && snapshot[3].count() == 1 && snapshot[3].max() >= snapshot[3].min();
+        std::ostringstream json{};
+        BST_latency::write_json(json, snapshot);
+        result = result && json.str().find("\"operator[]\": {\"count\": 2,") != std::string::npos;
+        BST_latency::reset();
+        result = result && BST_latency::snapshot()[0].count() == 0;
+        std::cerr << "latency recording test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+#else
+        std::cerr << "latency histograms not compiled in, test passed" << std::endl;
+        return true;
+#endif
+    }
+
+    bool Tester::test_complexity() const {
+
+        std::cout << "** Testing complexity contracts **" << std::endl;
+        const int size{100000};
+        std::vector<int> keys(size);
+        for (int i{0}; i < size; ++i)
+            keys[i] = 2 * i;    //odd keys are missing
+        std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+
+        bst_type tree{};
+        for (const int key : keys)
+            tree.insert(key, "");    //short strings do not allocate
+        bst_type balanced{tree};
+        balanced.balance();
+        const size_t optimal{static_cast<size_t>(std::ceil(std::log2(size + 1.0)))};
+        bool result{balanced.height() <= optimal && balanced.stats().height_ratio == 1.0 && tree.height() > optimal};
+        std::cerr << "height after balance test " << (result ? "passed" : "failed") << std::endl;
+
+        const size_t allocations{BST_benchmark::heap_allocations.load()};
+        const bst_type copy{tree};
+        result = result && BST_benchmark::heap_allocations.load() - allocations == static_cast<size_t>(size) && copy.size() == tree.size();
+        std::cerr << "allocations of copy test " << (result ? "passed" : "failed") << std::endl;
+
+        if constexpr (bst_type::probing) {    //a lookup visits at most one node per level
+            for (const bst_type* t : {&tree, &balanced}) {
+                const size_t height{t->height()};
+                for (int key{-1}; key < 2 * size; key += 7) {
+                    const_cast<bst_type*>(t)->reset_probe_stats();
+                    t->find(key);
+                    const auto probes = t->probe_stats();
+                    result = result && probes.find_nodes <= height && probes.find_comparisons <= 2 * probes.find_nodes;
+                }
+            }
+            std::cerr << "nodes visited by find test " << (result ? "passed" : "failed") << std::endl;
+        }
+
+        BST<counted_key, int, counting_less> counted{};
+        for (const int key : keys)
+            counted.insert(counted_key{key}, 0);
+        const size_t height{counted.height()};
+        counted_key::copies = 0;
+        for (int key{-1}; key < 2 * size; key += 7) {    //hits and misses
+            const counted_key sought{key};
+            counting_less::calls = 0;
+            counted.find(sought);
+            result = result && counting_less::calls <= 2 * height;
+        }
+        result = result && counted_key::copies == 0;
+        std::cerr << "key copies and comparisons of find test " << (result ? "passed" : "failed") << std::endl;
+
+        const counted_key added{-2}, existing{0};
+        counted.insert(added, 0);    //a new key is copied once, into its node
+        result = result && counted_key::copies == 1;
+        counted.insert(existing, 1);    //an existing key is not copied
+        result = result && counted_key::copies == 1;
+        counted_key::copies = 0;
+        const BST<counted_key, int, counting_less> counted_copy{counted};
+        result = result && counted_key::copies == counted.size();
+        counted_key::copies = 0;
+        counted.balance();    //each key is copied out of the tree and into its new node
+        result = result && counted_key::copies <= 2 * counted.size() && counted.height() <= optimal;
+        std::cerr << "key copies of insert, copy and balance test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_storage() const {
+
+        std::cout << "** Testing node storage **" << std::endl;
+        const bool reserved{BST_storage::arena::created() != nullptr};
+        if (BST_storage::current_mode() == BST_storage::mode::heap) {    //heap nodes never reserve the range
+            bst_type heap{};
+            heap.insert(1, "1");
+        }
+        const bool lazy{(BST_storage::arena::created() != nullptr) == reserved && BST_storage::stats().available == reserved};
+        std::cerr << "lazy reservation test " << (lazy ? "passed" : "failed") << std::endl;
+        const BST_storage::arena& arena{BST_storage::arena::instance()};
+        if (!BST_storage::stats().available) {
+            const bool result{!BST_storage::set_mode(BST_storage::mode::pages) && BST_storage::current_mode() == BST_storage::mode::heap};
+            std::cerr << "node storage unavailable, storage test " << (result ? "passed" : "failed") << std::endl;
+            return lazy && result;
+        }
+        auto placed = [&arena](const bst_type& tree, const int lo, const int hi, const bool owned, const bool huge) {
+            bool ok{true};
+            for (int key{lo}; key < hi; ++key) {
+                auto it = tree.find(key);
+                ok = ok && it != tree.end() && arena.owns(&*it) == owned && (!owned || arena.huge(&*it) == huge);
+            }
+            return ok;
+        };
+
+        bst_type tree{};
+        bool result{lazy && BST_storage::set_mode(BST_storage::mode::pages)};
+        for (int key{0}; key < 10000; ++key)
+            tree.insert(key, std::to_string(key));
+        result = result && BST_storage::set_mode(BST_storage::mode::huge_pages);
+        for (int key{10000}; key < 20000; ++key)
+            tree.insert(key, std::to_string(key));
+        result = result && BST_storage::set_mode(BST_storage::mode::heap);
+        for (int key{20000}; key < 30000; ++key)
+            tree.insert(key, std::to_string(key));
+        const auto stats = BST_storage::stats();
+        result = result && placed(tree, 0, 10000, true, false) && placed(tree, 10000, 20000, true, true) && placed(tree, 20000, 30000, false, false)
+                 && stats.page_regions > 0 && stats.huge_regions > 0 && stats.current == BST_storage::mode::heap;
+        {
+            BST_storage::set_mode(BST_storage::mode::pages);
+            const bst_type copy{tree};
+            result = result && copy.size() == tree.size() && placed(copy, 0, 30000, true, false);
+        }
+        const size_t carved{BST_storage::stats().page_regions};
+        tree.clear();    //nodes of all three kinds are freed, pooled ones are reused
+        for (int key{0}; key < 10000; ++key)
+            tree.insert(key, "");
+        result = result && BST_storage::stats().page_regions == carved && placed(tree, 0, 10000, true, false);
+        std::cerr << "storage modes test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type built{};
+        std::thread builder{[&built]() {    //the nodes outlive the thread, whose slots go to the orphans
+            for (int key{0}; key < 5000; ++key)
+                built.insert(key, "");
+        }};
+        builder.join();
+        const size_t regions{BST_storage::stats().page_regions};
+        built.clear();
+        std::thread adopter{[&result, &placed]() {
+            bst_type other{};
+            for (int key{0}; key < 5000; ++key)
+                other.insert(key, "");
+            result = result && placed(other, 0, 5000, true, false);
+        }};
+        adopter.join();
+        result = result && BST_storage::stats().page_regions == regions;
+
+        bst_type orphaned{};
+        std::thread{[&orphaned]() {
+            for (int key{0}; key < 5000; ++key)
+                orphaned.insert(key, "");
+        }}.join();
+        std::vector<const void*> slots;
+        for (auto& x : orphaned) slots.push_back(&x);
+        std::sort(slots.begin(), slots.end());
+        std::thread{[&orphaned]() { orphaned.clear(); }}.join();    //a thread that only frees nodes hands them over too
+        std::thread{[&result, &slots]() {
+            bst_type again{};
+            for (int key{0}; key < 5000; ++key)
+                again.insert(key, "");
+            for (auto& x : again)
+                result = result && std::binary_search(slots.begin(), slots.end(), static_cast<const void*>(&x));
+        }}.join();
+
+        bst_type pooled{};
+        for (int key{0}; key < 5000; ++key)
+            pooled.insert(key, "");
+        slots.clear();
+        for (auto& x : pooled) slots.push_back(&x);
+        std::sort(slots.begin(), slots.end());
+        BST_storage::set_mode(BST_storage::mode::heap);
+        pooled.clear();    //slots freed in heap mode go to the orphans rather than to a cache heap mode never reads
+        BST_storage::set_mode(BST_storage::mode::pages);
+        std::thread{[&result, &slots]() {
+            bst_type again{};
+            for (int key{0}; key < 5000; ++key)
+                again.insert(key, "");
+            for (auto& x : again)
+                result = result && std::binary_search(slots.begin(), slots.end(), static_cast<const void*>(&x));
+        }}.join();
+        BST_storage::set_mode(BST_storage::mode::heap);
+        std::cerr << "storage across threads test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_compact() const {
+
+        std::cout << "** Testing compact **" << std::endl;
+        auto by_address = [](const bst_type& tree) {    //keys in the order of the addresses of their nodes
+            std::vector<std::pair<const void*, int>> nodes;
+            for (auto it = tree.begin(); it != tree.end(); ++it)
+                nodes.push_back({&*it, (*it).first});
+            std::sort(nodes.begin(), nodes.end());
+            std::vector<int> keys;
+            for (const auto& n : nodes)
+                keys.push_back(n.second);
+            return keys;
+        };
+        auto consistent = [](const bst_type& tree) {    //parents agree with children
+            bool ok{!tree.root || !tree.root->parent};
+            tree.visit(tree.root.get(), nullptr, nullptr, [&ok](bst_type::node_type& n) {
+                ok = ok && (!n.left_child || n.left_child->parent == &n) && (!n.right_child || n.right_child->parent == &n);
+            });
+            return ok;
+        };
+
+        bst_type perfect{};
+        for (int key{1}; key <= 15; ++key)
+            perfect.insert(key, std::to_string(key));
+        perfect.balance();
+        perfect.compact(BST_storage::layout::breadth_first);
+        const bool contiguous{BST_storage::stats().available};    //the range is reserved by the first compact
+        bool result{consistent(perfect) && perfect.size() == 15 && perfect.height() == 4};
+        if (contiguous)
+            result = result && by_address(perfect) == std::vector<int>{8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15};
+        perfect.compact();
+        result = result && consistent(perfect) && perfect.size() == 15 && perfect.height() == 4;
+        if (contiguous)
+            result = result && by_address(perfect) == std::vector<int>{8, 4, 12, 2, 1, 3, 6, 5, 7, 10, 9, 11, 14, 13, 15};
+        for (int key{1}; key <= 15; ++key)
+            result = result && perfect[key] == std::to_string(key);
+        std::cerr << "compact layout test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type tree{};
+        std::mt19937 generator{7};
+        std::vector<std::pair<int, std::string>> pairs;
+        for (int i{0}; i < 20000; ++i) {
+            const int key{static_cast<int>(generator() % 1000000)};
+            tree.insert(key, std::to_string(key));
+        }
+        for (const auto& x : tree)
+            pairs.push_back(x);
+        const size_t height{tree.height()};
+        tree.enable_index();
+        tree.enable_filter();
+        for (const auto order : {BST_storage::layout::van_emde_boas, BST_storage::layout::breadth_first}) {
+            tree.compact(order);
+            std::vector<std::pair<int, std::string>> after;
+            for (const auto& x : tree)
+                after.push_back(x);
+            result = result && after == pairs && consistent(tree) && tree.height() == height;
+            for (const auto& x : pairs)
+                result = result && tree.find(x.first) != tree.end() && (*tree.find(x.first)).second == x.second;
+        }
+        tree.disable_index();
+        tree.disable_filter();
+        tree.insert(-1, "-1");    //the compacted tree keeps working as usual
+        tree.balance();
+        tree.compact();
+        result = result && tree.size() == pairs.size() + 1 && tree.find(-1) != tree.end() && consistent(tree);
+
+        bst_type chain{};
+        for (int key{0}; key < 65536; ++key)
+            chain.insert(key, "");
+        chain.compact();    //a chain 65536 levels tall, laid out without deep recursion
+        result = result && chain.size() == 65536 && chain.height() == 65536 && consistent(chain) && (*chain.begin()).first == 0;
+        std::cerr << "compact contents test " << (result ? "passed" : "failed") << std::endl;
+
+        BST<int, fragile_value> fragile{};
+        for (int key{0}; key < 100; ++key)
+            fragile.insert(key, fragile_value{key});
+        fragile_value::copies_left = 50;
+        try {
+            fragile.compact();
+            result = false;
+        }
+        catch (const std::runtime_error&) {
+        }
+        fragile_value::copies_left = -1;
+        int expected{0};
+        for (const auto& x : fragile)
+            result = result && x.first == expected && x.second.value == expected++;
+        result = result && expected == 100 && fragile.size() == 100;
+        std::cerr << "compact exception safety test " << (result ? "passed" : "failed") << std::endl;
+
+        bst_type cycled{};    //the slots of a freed block make up the next one
+        size_t regions{0};
+        for (int cycle{0}; cycle < 5; ++cycle) {
+            for (int key{0}; key < 20000; ++key)
+                cycled.insert(key * 7919 % 20000, "");
+            cycled.compact();
+            if (cycle == 1)
+                regions = BST_storage::stats().page_regions;
+            cycled.clear();
+        }
+        result = result && (!contiguous || BST_storage::stats().page_regions == regions);
+        std::cerr << "compact reuse test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_inline() const {
+
+        std::cout << "** Testing inline storage of small trees **" << std::endl;
+        using small_type = BST<std::string, int, std::less<std::string>, 16>;
+        auto consistent = [](const auto& tree) {    //parents agree with children
+            bool ok{!tree.root || !tree.root->parent};
+            tree.visit(tree.root.get(), nullptr, nullptr, [&ok](auto& n) {
+                ok = ok && (!n.left_child || n.left_child->parent == &n) && (!n.right_child || n.right_child->parent == &n);
+            });
+            return ok;
+        };
+        auto sorted = [](const auto& tree) {
+            std::vector<std::string> keys;
+            for (const auto& x : tree)
+                keys.push_back(x.first);
+            return keys.size() == tree.size() && std::is_sorted(keys.begin(), keys.end());
+        };
+        std::vector<std::string> keys{"a", "zz"};    //most of the keys share their prefix
+        for (int i{0}; i < 14; ++i)
+            keys.push_back("session:" + std::to_string(i * 5 % 14));
+
+        small_type tree{};
+        const size_t allocations{BST_benchmark::heap_allocations.load()};
+        for (size_t i{0}; i < keys.size(); ++i)
+            tree.insert(keys[i], static_cast<int>(i));
+        bool result{BST_benchmark::heap_allocations.load() == allocations && tree.is_inline() && tree.size() == 16};
+        result = result && sorted(tree) && consistent(tree) && tree.height() <= 16;
+        tree.balance();    //the nodes are linked again, they stay where they are
+        result = result && sorted(tree) && consistent(tree) && tree.height() == 5 && !std::less<const void*>{}(&*tree.begin(), &tree) &&
+            std::less<const void*>{}(&*tree.begin(), &tree + 1);
+        for (size_t i{0}; i < keys.size(); ++i)
+            result = result && tree.find(keys[i]) != tree.end() && (*tree.find(keys[i])).second == static_cast<int>(i);
+        result = result && tree.find("session:") == tree.end() && tree.find("session:99") == tree.end() && tree.find("") == tree.end();
+        int& first{tree["a"]};
+        tree["a"] = -1;
+        tree.insert("zz", -2);
+        result = result && tree.size() == 16 && first == -1 && tree["zz"] == -2 && tree.is_inline();
+        std::atomic<int> sum{0};
+        tree.for_each(BST_execution::par, [&sum](const small_type::pair_type& x) { sum += x.second; });
+        result = result && sum == (2 + 15) * 14 / 2 - 3;
+        std::cerr << "inline insert and find test " << (result ? "passed" : "failed") << std::endl;
+
+        small_type copy{tree};
+        small_type moved{std::move(copy)};
+        result = result && copy.size() == 0 && copy.begin() == copy.end() && copy.is_inline() && moved.size() == 16;
+        copy = moved;
+        moved.insert("b", 0);    //the seventeenth pair moves the nodes to the heap
+        result = result && !moved.is_inline() && moved.size() == 17 && sorted(moved) && consistent(moved) && moved["a"] == -1;
+        result = result && copy.is_inline() && copy.size() == 16 && copy.find("b") == copy.end() && sorted(copy);
+        copy = std::move(moved);
+        result = result && !copy.is_inline() && copy.size() == 17 && moved.is_inline() && moved.size() == 0;
+        moved.insert("c", 3);
+        result = result && moved.size() == 1 && (*moved.begin()).first == "c";
+        copy.clear();
+        copy.insert("d", 4);
+        result = result && copy.is_inline() && copy.size() == 1 && consistent(copy);
+        std::cerr << "inline copy and move test " << (result ? "passed" : "failed") << std::endl;
+
+        small_type indexed{};
+        indexed.enable_index();
+        indexed.enable_filter();
+        for (int i{0}; i < 40; ++i) {
+            indexed.insert("k" + std::to_string(i), i);
+            indexed.balance();
+            indexed.compact();
+            for (int j{0}; j <= i; ++j)
+                result = result && indexed.find("k" + std::to_string(j)) != indexed.end() && indexed["k" + std::to_string(j)] == j;
+            result = result && indexed.find("k" + std::to_string(i + 1)) == indexed.end() && indexed.is_inline() == (i < 16);
+        }
+        result = result && sorted(indexed) && consistent(indexed) && indexed.height() == 6;
+        indexed.clear();
+        result = result && indexed.is_inline() && indexed.find("k1") == indexed.end();
+        std::cerr << "inline index and balance test " << (result ? "passed" : "failed") << std::endl;
+
+        BST<int, fragile_value, std::less<int>, 8> fragile{};
+        for (int key{0}; key < 8; ++key)
+            fragile.insert(key, fragile_value{key});
+        fragile_value::copies_left = 4;
+        try {
+            fragile.insert(8, fragile_value{8});    //the heap copies fail half way
+            result = false;
+        }
+        catch (const std::runtime_error&) {
+        }
+        fragile_value::copies_left = -1;
+        int expected{0};
+        for (const auto& x : fragile)
+            result = result && x.first == expected && x.second.value == expected++;
+        result = result && expected == 8 && fragile.is_inline() && consistent(fragile);
+        fragile.insert(8, fragile_value{8});
+        result = result && fragile.size() == 9 && !fragile.is_inline() && (*fragile.find(8)).second.value == 8;
+        std::cerr << "inline exception safety test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
+
+    bool Tester::test_dense() const {
+
+        std::cout << "** Testing direct addressing of dense keys **" << std::endl;
+        //whether tree holds the pairs of reference, as seen by find, the iterator, visits and export_columns
+        auto agrees = [](const auto& tree, const auto& reference, const auto& absent) {
+            using pair_type = std::pair<typename std::decay_t<decltype(reference)>::key_type, int>;
+            const std::vector<pair_type> pairs(reference.begin(), reference.end());
+            std::vector<pair_type> visited, iterated, ranged, expected_range;
+            tree.visit_inorder([&visited](const auto& x) { visited.push_back(x); });
+            for (const auto& x : tree)
+                iterated.push_back(x);
+            const auto lo{pairs[pairs.size() / 4].first}, hi{pairs[pairs.size() / 2].first};
+            tree.visit_range(lo, hi, [&ranged](const auto& x) { ranged.push_back(x); });
+            for (const auto& x : pairs)
+                if (!(x.first < lo) && x.first < hi)
+                    expected_range.push_back(x);
+            std::vector<typename pair_type::first_type> keys;
+            std::vector<int> values;
+            tree.export_columns(keys, values);
+            bool ok{visited == pairs && iterated == pairs && ranged == expected_range && tree.size() == pairs.size() && keys.size() == pairs.size()};
+            for (size_t i{0}; ok && i < pairs.size(); ++i)
+                ok = keys[i] == pairs[i].first && values[i] == pairs[i].second && tree.find(pairs[i].first) != tree.end() &&
+                    (*tree.find(pairs[i].first)).first == pairs[i].first && (*tree.find(pairs[i].first)).second == pairs[i].second;
+            for (const auto key : absent)
+                ok = ok && (reference.count(key) || tree.find(key) == tree.end());
+            return ok;
+        };
+
+        using dense_type = BST<std::uint32_t, int>;
+        std::mt19937 generator{11};
+        std::map<std::uint32_t, int> reference;
+        std::vector<std::uint32_t> keys, absent{0, 1, 499, 501, 999, 1003, 1503, 1993, 2000, 2999, 3000, 4000000000u};
+        for (std::uint32_t key{1000}; key < 2000; ++key)
+            if (key % 10 != 3)    //one key in ten is missing
+                keys.push_back(key);
+        std::shuffle(keys.begin(), keys.end(), generator);
+        dense_type tree{};
+        for (const auto key : keys) {
+            tree.insert(key, static_cast<int>(key));
+            reference[key] = static_cast<int>(key);
+        }
+        tree.enable_dense();
+        bool result{tree.is_dense() && tree.dense_memory() >= 1000 * sizeof(void*) && agrees(tree, reference, absent)};
+        for (std::uint32_t key{2000}; key < 3000; ++key) {    //appended keys extend the array
+            tree.insert(key, static_cast<int>(key));
+            reference[key] = static_cast<int>(key);
+        }
+        result = result && tree.is_dense() && agrees(tree, reference, absent);
+        for (const std::uint32_t key : {600u, 500u}) {    //keys below the array move it up
+            tree.insert(key, static_cast<int>(key));
+            reference[key] = static_cast<int>(key);
+        }
+        tree.insert(1500, -1);
+        reference[1500] = -1;
+        result = result && tree.is_dense() && agrees(tree, reference, absent);
+
+        dense_type shifted{};    //keys landing in the free slots left below the array by a shift widen its range
+        for (std::uint32_t key{1000}; key < 1100; ++key)
+            shifted.insert(key, 0);
+        shifted.enable_dense(0.6);
+        shifted.insert(999, 0);    //moves the array up, leaving 100 free slots, 899 to 998
+        result = result && shifted.is_dense();
+        shifted.insert(899, 0);    //in the first free slot: 102 keys over 201 are too sparse
+        result = result && !shifted.is_dense() && shifted.find(899) != shifted.end();
+        std::cerr << "dense array test " << (result ? "passed" : "failed") << std::endl;
+
+        dense_type copy{tree};
+        result = result && copy.is_dense() && agrees(copy, reference, absent) && &*copy.find(1500) != &*tree.find(1500);
+        dense_type moved{std::move(copy)};
+        result = result && moved.is_dense() && agrees(moved, reference, absent) && !copy.is_dense();
+        tree.compact();
+        result = result && tree.is_dense() && agrees(tree, reference, absent);
+        tree.insert(4000000000u, 0);    //too sparse now, the tree takes over
+        reference[4000000000u] = 0;
+        result = result && !tree.is_dense() && tree.dense_memory() == 0 && agrees(tree, reference, absent);
+        tree.balance();
+        result = result && !tree.is_dense() && agrees(tree, reference, absent);
+        tree.clear();
+        reference.clear();
+        for (const auto key : keys) {
+            tree.insert(key, static_cast<int>(key));
+            reference[key] = static_cast<int>(key);
+        }
+        result = result && !tree.is_dense();    //the keys are checked by balance
+        tree.balance();
+        result = result && tree.is_dense() && agrees(tree, reference, absent);
+        tree.enable_dense(1.0);
+        result = result && !tree.is_dense() && agrees(tree, reference, absent);
+        std::cerr << "dense switch test " << (result ? "passed" : "failed") << std::endl;
+
+        BST<int, int> negative{};
+        std::map<int, int> signed_reference;
+        for (int key{-300}; key <= 300; ++key)
+            if (key % 7 != 0) {
+                negative.insert(key, -key);
+                signed_reference[key] = -key;
+            }
+        negative.enable_dense(0.7);
+        result = result && negative.is_dense() && agrees(negative, signed_reference, std::vector<int>{-1000, -301, -7, 0, 7, 301});
+        negative.insert(-400, 400);
+        signed_reference[-400] = 400;
+        result = result && negative.is_dense() && agrees(negative, signed_reference, std::vector<int>{-1000, -401, -399, 0, 301});
+
+        const std::uint64_t top{std::numeric_limits<std::uint64_t>::max()};
+        BST<std::uint64_t, int> wide{};
+        std::map<std::uint64_t, int> wide_reference;
+        for (std::uint64_t key{top - 5}; key != 0; ++key) {
+            wide.insert(key, 1);
+            wide_reference[key] = 1;
+        }
+        wide.enable_dense();
+        result = result && wide.is_dense() && agrees(wide, wide_reference, std::vector<std::uint64_t>{0, 1, top - 6});
+        wide.insert(0, 1);    //the keys span the whole range of 2^64 values
+        wide_reference[0] = 1;
+        result = result && !wide.is_dense() && agrees(wide, wide_reference, std::vector<std::uint64_t>{1, top - 6});
+
+        BST<std::uint32_t, int, std::less<std::uint32_t>, 8> small{};
+        std::map<std::uint32_t, int> small_reference;
+        for (std::uint32_t key{1}; key <= 8; ++key) {
+            small.insert(key, static_cast<int>(key));
+            small_reference[key] = static_cast<int>(key);
+        }
+        small.enable_dense();
+        auto small_moved{std::move(small)};    //the inline nodes move, so does the array
+        result = result && small_moved.is_inline() && small_moved.is_dense() && agrees(small_moved, small_reference, std::vector<std::uint32_t>{0, 9});
+        small_moved.insert(9, 9);
+        small_reference[9] = 9;
+        result = result && !small_moved.is_inline() && small_moved.is_dense() && agrees(small_moved, small_reference, std::vector<std::uint32_t>{0, 10});
+        std::cerr << "dense key types test " << (result ? "passed" : "failed") << std::endl;
+        return result;
+    }
 }